@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdAtomic.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_ATOMIC_H_
+#define _AT_CMD_ATOMIC_H_
+
+/* Atomic member types of the public structs. C++ before C++23 has no
+   <stdatomic.h>, its std::atomic types have the same size and lock-free
+   representation, so the structs keep one layout in both languages. The
+   at_ names keep std:: out of the includer's global namespace */
+#ifdef __cplusplus
+#include <atomic>
+
+typedef std::atomic_bool at_atomic_bool;
+typedef std::atomic_int at_atomic_int;
+typedef std::atomic_uint at_atomic_uint;
+typedef std::atomic_flag at_atomic_flag;
+#else
+#include <stdatomic.h>
+
+typedef atomic_bool at_atomic_bool;
+typedef atomic_int at_atomic_int;
+typedef atomic_uint at_atomic_uint;
+typedef atomic_flag at_atomic_flag;
+#endif
+
+#endif //_AT_CMD_ATOMIC_H_
@@ -0,0 +1,222 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdBlock.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#endif
+
+#include "ATCmdBlock.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+// Busy spins before a contended lock gives up the CPU
+#define SPIN_LIMIT		(64)
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// The holder may be preempted on a single core, so long waits yield
+static inline void spin_lock(atomic_flag* lock)
+{
+    for (int n = 0; atomic_flag_test_and_set_explicit(lock, memory_order_acquire); n++) {
+#if defined(__unix__) || defined(__APPLE__)
+        if (n >= SPIN_LIMIT) {
+            sched_yield();
+            continue;
+        }
+#endif
+        cpu_relax();
+    }
+}
+
+static inline void spin_unlock(atomic_flag* lock)
+{
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+at_block_pool *ATCmdBlock_pool_init(void* mem, size_t size, int block_size)
+{
+    size_t head = AT_BLOCK_STRIDE(sizeof(at_block_pool));
+    size_t stride = AT_BLOCK_STRIDE(block_size);
+    at_block_pool* pool = mem;
+
+    if (size < head + stride)
+        return NULL;
+
+    atomic_flag_clear(&pool->lock);
+    pool->free = NULL;
+    pool->block_size = block_size;
+    pool->count = (size - head) / stride;
+    atomic_init(&pool->available, pool->count);
+    atomic_init(&pool->exhausted, 0);
+
+    for (int i = pool->count - 1; i >= 0; i--) {
+        at_block* blk = (at_block*)((char*)mem + head + i * stride);
+        blk->pool = pool;
+        blk->next = pool->free;
+        pool->free = blk;
+    }
+    return pool;
+}
+
+at_block *ATCmdBlock_alloc(at_block_pool* pool)
+{
+    spin_lock(&pool->lock);
+    at_block* blk = pool->free;
+    if (blk)
+        pool->free = blk->next;
+    spin_unlock(&pool->lock);
+
+    if (!blk) {
+        atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+        return NULL;
+    }
+    atomic_fetch_sub_explicit(&pool->available, 1, memory_order_relaxed);
+    blk->next = NULL;
+    blk->len = 0;
+    ATCmdBlock_data(blk)[0] = 0;
+    atomic_store_explicit(&blk->ref, 1, memory_order_relaxed);
+    return blk;
+}
+
+void ATCmdBlock_ref(at_block* blk)
+{
+    atomic_fetch_add_explicit(&blk->ref, 1, memory_order_relaxed);
+}
+
+void ATCmdBlock_unref(at_block* blk)
+{
+    at_block_pool* pool = blk->pool;
+
+    if (atomic_fetch_sub_explicit(&blk->ref, 1, memory_order_acq_rel) != 1)
+        return;
+
+    spin_lock(&pool->lock);
+    blk->next = pool->free;
+    pool->free = blk;
+    spin_unlock(&pool->lock);
+    atomic_fetch_add_explicit(&pool->available, 1, memory_order_relaxed);
+}
+
+at_block *ATCmdBlock_getline(ATParser *at, at_block_pool* pool)
+{
+    at_block* blk = ATCmdBlock_alloc(pool);
+    if (!blk)
+        return NULL;
+
+    blk->len = ATCmdParser_getline(at, ATCmdBlock_data(blk), pool->block_size);
+    if (blk->len < 0) {
+        ATCmdBlock_unref(blk);
+        return NULL;
+    }
+    return blk;
+}
+
+// Give the parser the next block to frame lines in, the parser buffer if none is left
+static void sink_arm(ATParser *at, at_block_sink* sink)
+{
+    sink->blk = ATCmdBlock_alloc(sink->pool);
+    if (sink->blk)
+        ATCmdParser_set_frame_buffer(at, ATCmdBlock_data(sink->blk), sink->pool->block_size);
+    else
+        ATCmdParser_set_frame_buffer(at, NULL, 0);
+}
+
+static void sink_line(void* parser, void* arg, const char* line, int len)
+{
+    at_block_sink* sink = arg;
+    at_block* blk = sink->blk;
+
+    if (!blk || line != ATCmdBlock_data(blk)) {
+        // Framed in the parser buffer while the pool was empty
+        if (!blk)
+            sink_arm(parser, sink);
+        if (!sink->blk) {
+            sink->dropped++;
+            return;
+        }
+        blk = sink->blk;
+        if (len > sink->pool->block_size - 1)
+            len = sink->pool->block_size - 1;
+        memcpy(ATCmdBlock_data(blk), line, len);
+    }
+    char* data = ATCmdBlock_data(blk);
+    while (len > 0 && (data[len - 1] == '\r' || data[len - 1] == '\n'))
+        len--;
+    data[len] = 0;
+    blk->len = len;
+    sink_arm(parser, sink);
+    sink->cb(parser, blk);
+}
+
+void ATCmdBlock_attach(ATParser *at, at_block_sink* sink)
+{
+    if (at->_line_cb == sink_line) {
+        at_block_sink* old = at->_line_arg;
+        if (old->blk)
+            ATCmdBlock_unref(old->blk);
+        old->blk = NULL;
+        ATCmdParser_set_frame_buffer(at, NULL, 0);
+    }
+    ATCmdParser_set_line_cb(at, sink ? sink_line : NULL, sink);
+    if (sink)
+        sink_arm(at, sink);
+}
+
+void ATCmdBlock_queue_init(at_block_queue* q)
+{
+    atomic_flag_clear(&q->lock);
+    q->head = 0;
+    q->tail = 0;
+}
+
+bool ATCmdBlock_queue_push(at_block_queue* q, at_block* blk)
+{
+    spin_lock(&q->lock);
+    bool room = q->tail - q->head < AT_BLOCK_QUEUE_LEN;
+    if (room)
+        q->slots[q->tail++ & (AT_BLOCK_QUEUE_LEN - 1)] = blk;
+    spin_unlock(&q->lock);
+    return room;
+}
+
+at_block *ATCmdBlock_queue_pop(at_block_queue* q)
+{
+    at_block* blk = NULL;
+
+    spin_lock(&q->lock);
+    if (q->head != q->tail)
+        blk = q->slots[q->head++ & (AT_BLOCK_QUEUE_LEN - 1)];
+    spin_unlock(&q->lock);
+    return blk;
+}
@@ -0,0 +1,182 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdBlock.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_BLOCK_H_
+#define _AT_CMD_BLOCK_H_
+
+#include "ATCmdAtomic.h"
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_BLOCK_ALIGN				(sizeof(void*) * 2)
+#define AT_BLOCK_STRIDE(block_size)	\
+    ((sizeof(at_block) + (block_size) + AT_BLOCK_ALIGN - 1) & ~(AT_BLOCK_ALIGN - 1))
+#define AT_BLOCK_QUEUE_LEN			(64)	/* blocks a queue holds, power of two */
+/* Memory needed by #ATCmdBlock_pool_init for count blocks */
+#define AT_BLOCK_POOL_SIZE(count, block_size) \
+    (AT_BLOCK_STRIDE(sizeof(at_block_pool)) + (count) * AT_BLOCK_STRIDE(block_size))
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+struct at_block_pool;
+
+/**
+ * Refcounted RX block holding one line, NUL terminated, in the pool's
+ * block_size bytes behind the header, see #ATCmdBlock_data
+ */
+typedef struct at_block {
+    struct at_block* next;          /* free list */
+    struct at_block_pool* pool;
+    at_atomic_int ref;
+    int len;
+} at_block;
+
+/**
+ * Fixed-size block pool carved from caller memory
+ */
+typedef struct at_block_pool {
+    at_atomic_flag lock;
+    at_block* free;
+    int block_size;
+    int count;
+    at_atomic_int available;
+    at_atomic_uint exhausted;       /* allocations that found the pool empty */
+} at_block_pool;
+
+/**
+ * Spinlocked FIFO of blocks for cross-thread handoff. Slots are the queue's
+ * own, so a block with several references may sit on several queues
+ */
+typedef struct {
+    at_atomic_flag lock;
+    unsigned head;                  /* free running */
+    unsigned tail;
+    at_block* slots[AT_BLOCK_QUEUE_LEN];
+} at_block_queue;
+
+/**
+ * Unprocessed lines of a parser framed into blocks, see #ATCmdBlock_attach
+ */
+typedef struct {
+    at_block_pool* pool;
+    void (*cb)(ATParser *at, at_block* blk);
+    uint32_t dropped;               /* lines lost because the pool was empty */
+    at_block* blk;                  /* the parser frames the next line here */
+} at_block_sink;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Build a pool in caller memory, no heap is used
+ *
+ * @param[in] 		mem: pool memory, pointer aligned
+ * @param[in] 		size: memory size, see #AT_BLOCK_POOL_SIZE
+ * @param[in] 		block_size: line capacity of a block including the terminator
+ *
+ * @return 			pool, NULL if not even one block fits
+ */
+at_block_pool *ATCmdBlock_pool_init(void* mem, size_t size, int block_size);
+
+/**
+ * @brief 			Take a block with one reference
+ *
+ * @return 			block, NULL: pool exhausted
+ */
+at_block *ATCmdBlock_alloc(at_block_pool* pool);
+
+/**
+ * @brief 			Add a reference before handing the block to another owner
+ */
+void ATCmdBlock_ref(at_block* blk);
+
+/**
+ * @brief 			Drop a reference, the last one returns the block to its pool
+ */
+void ATCmdBlock_unref(at_block* blk);
+
+/**
+ * @brief 			Line of a block
+ */
+static inline char* ATCmdBlock_data(at_block* blk)
+{
+    return (char*)(blk + 1);
+}
+
+/**
+ * @brief 			Receive the next line into a new block, out-of-band packets
+ *                  are dispatched meanwhile, e.g. to capture a URC payload inside
+ *                  its handler; a line longer than a block is truncated
+ *
+ * @return 			block with one reference, NULL: Timeout or pool exhausted
+ */
+at_block *ATCmdBlock_getline(ATParser *at, at_block_pool* pool);
+
+/**
+ * @brief 			Frame lines no handler claimed into blocks from sink->pool and
+ *                  pass them to sink->cb, which owns the reference. process_oob
+ *                  reads them straight into the block, see
+ *                  #ATCmdParser_set_frame_buffer, so lines longer than a block are
+ *                  discarded there; getline and recv are unaffected. NULL detaches
+ *
+ * @param[in] 		sink: sink, must stay valid while attached
+ *
+ * @return 			none
+ */
+void ATCmdBlock_attach(ATParser *at, at_block_sink* sink);
+
+void ATCmdBlock_queue_init(at_block_queue* q);
+
+/**
+ * @brief 			Append a block, the queue takes over the caller's reference
+ *
+ * @return 			true: Success, false: #AT_BLOCK_QUEUE_LEN blocks queued, the
+ *                  caller keeps its reference
+ */
+bool ATCmdBlock_queue_push(at_block_queue* q, at_block* blk);
+
+/**
+ * @brief 			Remove the oldest block, the caller gets its reference
+ *
+ * @return 			block, NULL: queue empty
+ */
+at_block *ATCmdBlock_queue_pop(at_block_queue* q);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_BLOCK_H_
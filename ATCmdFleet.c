@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdFleet.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "ATCmdFleet.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    at_fleet_device* devs;
+    int count;
+    const at_fleet_stage* stages;
+    int nstages;
+    atomic_int next;
+    atomic_int ok;
+} fleet_job;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static uint32_t fleet_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void fleet_run_device(fleet_job* job, at_fleet_device* dev)
+{
+    uint32_t start = fleet_ms();
+
+    dev->ok = true;
+    dev->failed_stage = -1;
+    dev->failed_step = -1;
+    for (int s = 0; s < job->nstages; s++) {
+        const at_fleet_stage* stage = &job->stages[s];
+        uint32_t t = fleet_ms();
+        int step = -1;
+        bool ok;
+
+        if (stage->steps)
+            ok = ATCmdSeq_run(dev->at, stage->steps, &step);
+        else
+            ok = stage->fn(dev->at);
+        dev->stage_ms[s] = fleet_ms() - t;
+
+        if (!ok) {
+            dev->ok = false;
+            dev->failed_stage = s;
+            dev->failed_step = step;
+            break;
+        }
+    }
+    if (dev->ok)
+        atomic_fetch_add(&job->ok, 1);
+    dev->total_ms = fleet_ms() - start;
+}
+
+static void* fleet_worker(void* arg)
+{
+    fleet_job* job = arg;
+    int i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count)
+        fleet_run_device(job, &job->devs[i]);
+    return NULL;
+}
+
+int ATCmdFleet_bringup(at_fleet_device* devs, int count, const at_fleet_stage* stages, int nstages,
+                       int threads, uint32_t* wall_ms)
+{
+    pthread_t pool[AT_FLEET_MAX_THREADS - 1];
+    fleet_job job = { devs, count, stages, nstages, 0, 0 };
+    uint32_t start = fleet_ms();
+    int started = 0;
+
+    if (count < 0 || nstages < 0 || nstages > AT_FLEET_MAX_STAGES)
+        return -1;
+    for (int s = 0; s < nstages; s++) {
+        if (!stages[s].steps && !stages[s].fn)
+            return -1;
+    }
+    if (threads > count)
+        threads = count;
+    if (threads > AT_FLEET_MAX_THREADS)
+        threads = AT_FLEET_MAX_THREADS;
+
+    // Calling thread is always one of the workers
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&pool[started], NULL, fleet_worker, &job) != 0)
+            break;
+    }
+    fleet_worker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    if (wall_ms)
+        *wall_ms = fleet_ms() - start;
+    return atomic_load(&job.ok);
+}
+
+bool ATCmdFleet_sync_stage(ATParser *at)
+{
+    return ATCmdParser_sync(at, AT_FLEET_SYNC_TIMEOUT, NULL);
+}
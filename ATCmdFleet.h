@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdFleet.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_FLEET_H_
+#define _AT_CMD_FLEET_H_
+
+#include "ATCmdSeq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_FLEET_MAX_STAGES		(8)
+#define AT_FLEET_MAX_THREADS	(64)	/* workers of one bring-up, the caller included */
+#define AT_FLEET_SYNC_TIMEOUT	(10000)	/* ms, used by #ATCmdFleet_sync_stage */
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Bring-up stage, runs the step table or, when steps is NULL, the function
+ */
+typedef struct {
+    const char* name;
+    const at_seq_step* steps;
+    bool (*fn)(ATParser *at);
+} at_fleet_stage;
+
+/**
+ * Per-device bring-up slot, at is filled by the caller, the rest is the result
+ */
+typedef struct {
+    ATParser* at;
+    bool ok;
+    int failed_stage;                       /* -1 when every stage passed */
+    int failed_step;                        /* step index inside the failed stage, -1 for a function stage */
+    uint32_t stage_ms[AT_FLEET_MAX_STAGES];
+    uint32_t total_ms;
+} at_fleet_device;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Bring up many parsers concurrently on a bounded pool of
+ *                  threads, each device runs all stages in order on one thread
+ *                  so the fleet is ready after the slowest device, not the sum
+ * @note    		Devices sharing one serial_ops implementation can find their
+ *                  port through #ATCmdParser_current
+ *
+ * @param[in,out] 	devs: device slots
+ * @param[in] 		count: number of devices
+ * @param[in] 		stages: stage table, at most #AT_FLEET_MAX_STAGES
+ * @param[in] 		nstages: number of stages
+ * @param[in] 		threads: worker threads, capped to count and #AT_FLEET_MAX_THREADS
+ * @param[out] 		wall_ms: time until the last device finished, may be NULL
+ *
+ * @return 			number of devices that completed every stage, -1: bad arguments
+ *                  or a stage with neither steps nor fn
+ */
+int ATCmdFleet_bringup(at_fleet_device* devs, int count, const at_fleet_stage* stages, int nstages,
+                       int threads, uint32_t* wall_ms);
+
+/**
+ * @brief 			Stage function waiting for the modem with #ATCmdParser_sync
+ */
+bool ATCmdFleet_sync_stage(ATParser *at);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_FLEET_H_
@@ -0,0 +1,150 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdFlight.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include "ATCmdFlight.h"
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static void flight_port_lock(void* arg)
+{
+    pthread_mutex_lock(arg);
+}
+
+static void flight_port_unlock(void* arg)
+{
+    pthread_mutex_unlock(arg);
+}
+
+void ATCmdFlight_init(at_flight* f, ATParser *at)
+{
+    f->at = at;
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    f->calls = NULL;
+    pthread_mutex_init(&f->port, NULL);
+    f->port_lock = flight_port_lock;
+    f->port_unlock = flight_port_unlock;
+    f->port_arg = &f->port;
+    f->leaders = 0;
+    f->shared = 0;
+}
+
+void ATCmdFlight_deinit(at_flight* f)
+{
+    pthread_mutex_destroy(&f->port);
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->lock);
+}
+
+void ATCmdFlight_set_lock(at_flight* f, void (*lock)(void* arg), void (*unlock)(void* arg), void* arg)
+{
+    f->port_lock = lock;
+    f->port_unlock = unlock;
+    f->port_arg = arg;
+}
+
+int ATCmdFlight_do(at_flight* f, const char* cmd, at_flight_fn fn, void* arg, void* result, int size)
+{
+    at_flight_call* call;
+    int ret;
+
+    pthread_mutex_lock(&f->lock);
+    for (call = f->calls; call; call = call->next) {
+        if (!call->done && call->fn == fn && call->arg == arg && strcmp(call->cmd, cmd) == 0)
+            break;
+    }
+
+    if (call) {
+        // Follower, the leader keeps the call alive until every waiter copied
+        call->waiters++;
+        f->shared++;
+        while (!call->done)
+            pthread_cond_wait(&f->cond, &f->lock);
+        ret = call->ret;
+        if (ret >= 0)
+            memcpy(result, call->result, size < call->size ? size : call->size);
+        if (--call->waiters == 0)
+            pthread_cond_broadcast(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+        return ret;
+    }
+
+    at_flight_call own = { f->calls, cmd, fn, arg, result, size, -1, 0, false };
+    f->calls = &own;
+    f->leaders++;
+    pthread_mutex_unlock(&f->lock);
+
+    f->port_lock(f->port_arg);
+    ret = fn(f->at, cmd, result, size, arg);
+    f->port_unlock(f->port_arg);
+
+    pthread_mutex_lock(&f->lock);
+    own.ret = ret;
+    own.done = true;
+    pthread_cond_broadcast(&f->cond);
+    while (own.waiters > 0)
+        pthread_cond_wait(&f->cond, &f->lock);
+    for (at_flight_call** p = &f->calls; *p; p = &(*p)->next) {
+        if (*p == &own) {
+            *p = own.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+    return ret;
+}
+
+static int flight_lines(ATParser *at, const char* cmd, void* result, int size, void* arg)
+{
+    char* resp = result;
+    char line[AT_BUFFER_SIZE / 4];
+    int len = 0;
+
+    (void)arg;
+    resp[0] = 0;
+    if (!ATCmdParser_send(at, "%s", cmd))
+        return -1;
+    while (ATCmdParser_getline(at, line, sizeof(line)) >= 0) {
+        if (strcmp(line, "OK") == 0)
+            return len;
+        if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0)
+            return -1;
+        // Skip the echo
+        if (strcmp(line, cmd) == 0)
+            continue;
+        int n = snprintf(resp + len, size - len, "%s%s", len ? "\n" : "", line);
+        len = n < size - len ? len + n : size - 1;
+    }
+    return -1;
+}
+
+int ATCmdFlight_query(at_flight* f, const char* cmd, char* resp, int size)
+{
+    int ret = ATCmdFlight_do(f, cmd, flight_lines, NULL, resp, size);
+
+    // A follower may copy a longer leader result
+    resp[size - 1] = 0;
+    if (ret < 0)
+        resp[0] = 0;
+    return ret < size ? ret : size - 1;
+}
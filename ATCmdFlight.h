@@ -0,0 +1,125 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdFlight.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_FLIGHT_H_
+#define _AT_CMD_FLIGHT_H_
+
+#include <pthread.h>
+
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Transaction run by the leader of a flight, fills result of size bytes
+ *
+ * @return 			>= 0: Success, shared with every waiter, -1: failure
+ */
+typedef int (*at_flight_fn)(ATParser *at, const char* cmd, void* result, int size, void* arg);
+
+/**
+ * In-flight transaction, lives on the leader's stack
+ */
+typedef struct at_flight_call {
+    struct at_flight_call* next;
+    const char* cmd;
+    at_flight_fn fn;
+    void* arg;
+    void* result;
+    int size;
+    int ret;
+    int waiters;
+    bool done;
+} at_flight_call;
+
+/**
+ * Single-flight group of one parser
+ */
+typedef struct {
+    ATParser* at;
+    pthread_mutex_t lock;           /* call list */
+    pthread_cond_t cond;
+    at_flight_call* calls;
+    pthread_mutex_t port;           /* default transaction lock */
+    void (*port_lock)(void* arg);
+    void (*port_unlock)(void* arg);
+    void* port_arg;
+    uint32_t leaders;               /* transactions run */
+    uint32_t shared;                /* calls answered by another caller's transaction */
+} at_flight;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+void ATCmdFlight_init(at_flight* f, ATParser *at);
+
+void ATCmdFlight_deinit(at_flight* f);
+
+/**
+ * @brief 			Serialise transactions with the caller's lock instead of the
+ *                  group's own, e.g. #ATCmdLoop_lock of the device
+ *
+ * @return 			none
+ */
+void ATCmdFlight_set_lock(at_flight* f, void (*lock)(void* arg), void (*unlock)(void* arg), void* arg);
+
+/**
+ * @brief 			Run fn for cmd, or if an identical call (same cmd text, fn
+ *                  and arg) is already in flight wait for it and take a copy
+ *                  of its result instead of occupying the port again
+ * @note    		A joined call may have been sent shortly before this one,
+ *                  use it for queries only, never for commands with effects
+ *
+ * @param[in] 		cmd: command text, the flight key
+ * @param[out] 		result: result buffer, the leader's result is copied up to size
+ *
+ * @return 			fn return value
+ */
+int ATCmdFlight_do(at_flight* f, const char* cmd, at_flight_fn fn, void* arg, void* result, int size);
+
+/**
+ * @brief 			Shared query collecting the information lines of the response,
+ *                  e.g. "+CSQ: 21,99", joined with '\n', parse them with sscanf
+ *
+ * @param[out] 		resp: response text, NUL terminated
+ * @param[in] 		size: resp size
+ *
+ * @return 			length of resp, -1: ERROR or Timeout
+ */
+int ATCmdFlight_query(at_flight* f, const char* cmd, char* resp, int size);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_FLIGHT_H_
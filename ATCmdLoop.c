@@ -0,0 +1,1113 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdLoop.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef ATCMDLOOP_IO_URING
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ATCmdLoop.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define LOOP_EVENTS		(64)
+
+// Pending loop work of a device, io_uring backend
+#define LOOP_IO_RX		(1u << 0)	/* arm the read */
+#define LOOP_IO_TX		(1u << 1)	/* submit txq */
+#define LOOP_IO_CANCEL	(1u << 2)	/* device removed, cancel its read */
+
+// Request kind in the low bits of the io_uring user_data, devices are aligned
+#define URING_RX		(0)
+#define URING_TX		(1)
+#define URING_CANCEL	(2)
+#define URING_WAKE		(3)
+#define URING_KIND_MASK	(3)
+
+// IORING_OP_READ_MULTISHOT, Linux 6.7, newer than most installed headers
+#define URING_OP_READ_MULTISHOT	(49)
+#define URING_ENTRIES	(256)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+#ifdef ATCMDLOOP_IO_URING
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_local;              /* prepared sqes */
+    unsigned sq_submitted;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    struct io_uring_buf_ring* br;   /* provided RX buffers, group 0 */
+    size_t br_len;
+    unsigned short br_tail;
+    char* bufs;
+    bool multishot;                 /* falls back to one read per completion */
+    uint64_t wake_val;
+} loop_uring;
+#endif
+
+struct at_loop {
+    at_loop_backend backend;
+    int epfd;
+    int wake;                       /* eventfd, starts ticking or stops the loop */
+    atomic_bool stop;
+    pthread_t thread;
+    pthread_mutex_t lock;           /* wheel and device list, recursive */
+    at_loop_dev* devs;
+    at_loop_dev* io_head;           /* devices with pending io_flags */
+    at_loop_dev* run_head;          /* devices waiting for a dispatch round */
+    at_loop_dev* run_tail;
+    bool sleeping;                  /* loop is waiting, a post must wake it */
+    atomic_ullong syscalls;
+    atomic_ullong rx_bytes;
+    atomic_ullong tx_bytes;
+    atomic_ullong wakeups;
+#ifdef ATCMDLOOP_IO_URING
+    loop_uring u;
+#endif
+    at_timer_wheel wheel;
+};
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+// Set on the loop thread, its parser calls must never block
+static __thread bool _in_loop;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static inline void loop_count(atomic_ullong* counter, uint64_t n)
+{
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static uint32_t loop_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline unsigned ring_used(const at_loop_dev* dev)
+{
+    return dev->rx_head - dev->rx_tail;
+}
+
+// Position of the last c in [from, to), false if there is none
+static bool ring_rchr(const at_loop_dev* dev, unsigned from, unsigned to, char c, unsigned* pos)
+{
+    while (to != from) {
+        unsigned end = to & (AT_LOOP_RX_SIZE - 1);
+        unsigned seg = end ? end : AT_LOOP_RX_SIZE;
+        unsigned n = to - from < seg ? to - from : seg;
+        const char* p = memrchr(dev->rx + seg - n, c, n);
+
+        if (p) {
+            *pos = to - (seg - (p - dev->rx));
+            return true;
+        }
+        to -= n;
+    }
+    return false;
+}
+
+// End of the last complete line in the ring, rx_tail if there is none. Lines
+// end in the whole input delimiter, as the parser frames them
+static unsigned ring_line_end(at_loop_dev* dev)
+{
+    const char* delim = dev->at->_input_delimiter;
+    int len = dev->at->_input_delim_size;
+    unsigned to = dev->rx_head;
+    unsigned pos;
+
+    while (ring_rchr(dev, dev->rx_tail, to, delim[len - 1], &pos)) {
+        int k = 1;
+        while (k < len && k <= (int)(pos - dev->rx_tail)
+                && dev->rx[(pos - k) & (AT_LOOP_RX_SIZE - 1)] == delim[len - 1 - k])
+            k++;
+        if (k == len)
+            return pos + 1;
+        to = pos;
+    }
+    return dev->rx_tail;
+}
+
+// A complete line is waiting, so idle processing will not stop mid-line
+static inline bool ring_has_line(at_loop_dev* dev)
+{
+    return ring_line_end(dev) != dev->rx_tail;
+}
+
+// The parser hands lines to someone, so the loop should dispatch them
+static inline bool dev_has_consumer(const at_loop_dev* dev)
+{
+    const ATParser* at = dev->at;
+    return at->_oobs || at->_nshared || at->_line_cb || at->unprocessed_data;
+}
+
+static void loop_wake(at_loop* loop);
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Queue a device for a dispatch round, wakes the loop only if it sleeps
+static void loop_runnable(at_loop* loop, at_loop_dev* dev)
+{
+    pthread_mutex_lock(&loop->lock);
+    if (!dev->queued && !dev->removed) {
+        dev->queued = true;
+        dev->run_next = NULL;
+        if (loop->run_tail)
+            loop->run_tail->run_next = dev;
+        else
+            loop->run_head = dev;
+        loop->run_tail = dev;
+    }
+    bool wake = loop->sleeping;
+    loop->sleeping = false;
+    pthread_mutex_unlock(&loop->lock);
+    if (wake && !_in_loop)
+        loop_wake(loop);
+}
+
+// Lines of a device until its deficit is spent, true if lines remain
+static bool loop_dispatch(at_loop_dev* dev)
+{
+    pthread_mutex_lock(&dev->rx_lock);
+    dev->rx_limit = ring_line_end(dev);
+    pthread_mutex_unlock(&dev->rx_lock);
+
+    // Only complete lines are framed, a trailing partial line stays in the
+    // ring for the next dispatch; a handler may read on past the limit
+    while (dev->deficit > 0 && (int)(dev->rx_limit - dev->rx_tail) > 0) {
+        // Only the dispatching thread moves the tail, each line is charged
+        unsigned tail = dev->rx_tail;
+        bool line = ATCmdParser_process_line(dev->at);
+        dev->deficit -= dev->rx_tail - tail;
+        if (!line)
+            break;
+    }
+
+    pthread_mutex_lock(&dev->rx_lock);
+    bool more = ring_has_line(dev);
+    pthread_mutex_unlock(&dev->rx_lock);
+    return more;
+}
+
+/* Deficit round robin over the devices queued when the round starts: each gets
+   its quantum of bytes, devices with lines left go to the back of the queue.
+   Returns true if devices are still waiting */
+static bool loop_schedule(at_loop* loop)
+{
+    pthread_mutex_lock(&loop->lock);
+    at_loop_dev* last = loop->run_tail;
+    while (loop->run_head) {
+        at_loop_dev* dev = loop->run_head;
+        bool end = dev == last;
+        loop->run_head = dev->run_next;
+        if (!loop->run_head)
+            loop->run_tail = NULL;
+        dev->queued = false;
+
+        // A thread driving the parser reads its lines, unlock queues the rest
+        if (pthread_mutex_trylock(&dev->lock) != 0) {
+            dev->deficit = 0;
+        } else {
+            pthread_mutex_unlock(&loop->lock);
+            uint64_t t0 = thread_cpu_ns();
+            dev->deficit += dev->quantum > 0 ? dev->quantum : AT_LOOP_QUANTUM;
+            bool more = loop_dispatch(dev);
+            dev->oob_runs++;
+            dev->cpu_ns += thread_cpu_ns() - t0;
+
+            // Lock order is device before loop, as for callers arming timers
+            pthread_mutex_lock(&loop->lock);
+            if (more && !dev->removed) {
+                dev->queued = true;
+                dev->run_next = NULL;
+                if (loop->run_tail)
+                    loop->run_tail->run_next = dev;
+                else
+                    loop->run_head = dev;
+                loop->run_tail = dev;
+            } else {
+                dev->deficit = 0;
+            }
+            pthread_mutex_unlock(&dev->lock);
+        }
+        if (end)
+            break;
+    }
+    bool pending = loop->run_head != NULL;
+    pthread_mutex_unlock(&loop->lock);
+    return pending;
+}
+
+// Received bytes of either backend into the device ring
+static void loop_rx(at_loop* loop, at_loop_dev* dev, const char* buf, int n)
+{
+    loop_count(&loop->rx_bytes, n);
+
+    pthread_mutex_lock(&dev->rx_lock);
+    unsigned space = AT_LOOP_RX_SIZE - ring_used(dev);
+    unsigned copy = (unsigned)n < space ? (unsigned)n : space;
+    unsigned head = dev->rx_head & (AT_LOOP_RX_SIZE - 1);
+    unsigned first = copy < AT_LOOP_RX_SIZE - head ? copy : AT_LOOP_RX_SIZE - head;
+    memcpy(dev->rx + head, buf, first);
+    memcpy(dev->rx, buf + first, copy - first);
+    dev->rx_head += copy;
+    dev->rx_dropped += n - copy;
+    bool line = dev_has_consumer(dev) && ring_has_line(dev);
+    pthread_cond_signal(&dev->rx_cond);
+    pthread_mutex_unlock(&dev->rx_lock);
+
+    // Dispatched in the next round unless a thread is driving the parser
+    if (line)
+        loop_runnable(loop, dev);
+}
+
+static void loop_read(at_loop* loop, at_loop_dev* dev)
+{
+    char buf[4096];
+    int n = read(dev->fd, buf, sizeof(buf));
+
+    loop_count(&loop->syscalls, 1);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // Port gone, waiters run into their deadline
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+        }
+        return;
+    }
+    loop_rx(loop, dev, buf, n);
+}
+
+static void* loop_thread(void* arg)
+{
+    at_loop* loop = arg;
+    struct epoll_event ev[LOOP_EVENTS];
+
+    bool pending = false;
+
+    _in_loop = true;
+    while (!atomic_load(&loop->stop)) {
+        pthread_mutex_lock(&loop->lock);
+        int timeout = pending ? 0 : loop->wheel.count ? loop->wheel.tick_ms : -1;
+        loop->sleeping = timeout != 0;
+        pthread_mutex_unlock(&loop->lock);
+
+        int n = epoll_wait(loop->epfd, ev, LOOP_EVENTS, timeout);
+        pthread_mutex_lock(&loop->lock);
+        loop->sleeping = false;
+        pthread_mutex_unlock(&loop->lock);
+        loop_count(&loop->syscalls, 1);
+        loop_count(&loop->wakeups, 1);
+        for (int i = 0; i < n; i++) {
+            if (ev[i].data.ptr) {
+                loop_read(loop, ev[i].data.ptr);
+            } else {
+                uint64_t v;
+                loop_count(&loop->syscalls, 1);
+                if (read(loop->wake, &v, sizeof(v)) < 0)
+                    continue;
+            }
+        }
+        pending = loop_schedule(loop);
+
+        pthread_mutex_lock(&loop->lock);
+        ATCmdTimer_advance(&loop->wheel, loop_ms());
+        pthread_mutex_unlock(&loop->lock);
+    }
+    return NULL;
+}
+
+static void loop_wake(at_loop* loop)
+{
+    uint64_t v = 1;
+    loop_count(&loop->syscalls, 1);
+    if (write(loop->wake, &v, sizeof(v)) < 0)
+        return;
+}
+
+#ifdef ATCMDLOOP_IO_URING
+/* io_uring backend on raw syscalls, no liburing needed */
+
+// Queue loop work for a device, wakes the loop only if it sleeps
+static void loop_post(at_loop* loop, at_loop_dev* dev, unsigned flags)
+{
+    pthread_mutex_lock(&loop->lock);
+    if (!dev->io_flags) {
+        dev->io_next = loop->io_head;
+        loop->io_head = dev;
+    }
+    dev->io_flags |= flags;
+    bool wake = loop->sleeping;
+    loop->sleeping = false;
+    pthread_mutex_unlock(&loop->lock);
+    if (wake && !_in_loop)
+        loop_wake(loop);
+}
+
+static int uring_enter(at_loop* loop, unsigned wait, int timeout)
+{
+    loop_uring* u = &loop->u;
+    unsigned submit = u->sq_local - u->sq_submitted;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void* argp = NULL;
+    size_t argsz = 0;
+
+    if (!submit && !wait)
+        return 0;
+    atomic_store_explicit((_Atomic unsigned*)u->sq_tail, u->sq_local, memory_order_release);
+    if (wait && timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000ll;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    loop_count(&loop->syscalls, 1);
+    int ret = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, argp, argsz);
+    if (ret >= 0)
+        u->sq_submitted += ret;
+    return ret;
+}
+
+static struct io_uring_sqe* uring_sqe(at_loop* loop)
+{
+    loop_uring* u = &loop->u;
+
+    while (u->sq_local - atomic_load_explicit((_Atomic unsigned*)u->sq_head, memory_order_acquire) >= u->entries) {
+        if (uring_enter(loop, 0, 0) < 0)
+            return NULL;
+    }
+    struct io_uring_sqe* sqe = &u->sqes[u->sq_local++ & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void uring_buf_recycle(loop_uring* u, unsigned bid)
+{
+    struct io_uring_buf* buf = &u->br->bufs[u->br_tail & (AT_LOOP_URING_BUFS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(u->bufs + bid * AT_LOOP_URING_BUF_SIZE);
+    buf->len = AT_LOOP_URING_BUF_SIZE;
+    buf->bid = bid;
+    u->br_tail++;
+    atomic_store_explicit((_Atomic unsigned short*)&u->br->tail, u->br_tail, memory_order_release);
+}
+
+static void uring_arm_rx(at_loop* loop, at_loop_dev* dev)
+{
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    if (!sqe)
+        return;
+    sqe->opcode = loop->u.multishot ? URING_OP_READ_MULTISHOT : IORING_OP_READ;
+    sqe->fd = dev->fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = loop->u.multishot ? 0 : AT_LOOP_URING_BUF_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)dev | URING_RX;
+}
+
+static void uring_submit_tx(at_loop* loop, at_loop_dev* dev)
+{
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = dev->fd;
+    sqe->off = (uint64_t)-1;
+    sqe->addr = (uint64_t)(uintptr_t)(dev->txq + dev->txq_off);
+    sqe->len = dev->txq_len - dev->txq_off;
+    sqe->user_data = (uint64_t)(uintptr_t)dev | URING_TX;
+}
+
+static void uring_arm_wake(at_loop* loop)
+{
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wake;
+    sqe->off = (uint64_t)-1;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->u.wake_val;
+    sqe->len = sizeof(loop->u.wake_val);
+    sqe->user_data = URING_WAKE;
+}
+
+// The kernel released a request of the device, removal waits for the last one
+static void uring_release(at_loop_dev* dev)
+{
+    pthread_mutex_lock(&dev->rx_lock);
+    dev->inflight--;
+    pthread_cond_broadcast(&dev->rx_cond);
+    pthread_mutex_unlock(&dev->rx_lock);
+}
+
+static void uring_tx_done(at_loop_dev* dev)
+{
+    pthread_mutex_lock(&dev->rx_lock);
+    dev->tx_busy = false;
+    dev->inflight--;
+    pthread_cond_broadcast(&dev->rx_cond);
+    pthread_mutex_unlock(&dev->rx_lock);
+}
+
+static void uring_complete(at_loop* loop, struct io_uring_cqe* cqe)
+{
+    loop_uring* u = &loop->u;
+    at_loop_dev* dev = (at_loop_dev*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_KIND_MASK);
+    int res = cqe->res;
+
+    switch (cqe->user_data & URING_KIND_MASK) {
+    case URING_WAKE:
+        uring_arm_wake(loop);
+        break;
+    case URING_CANCEL:
+        break;
+    case URING_TX:
+        if (res > 0 && (dev->txq_off += res) < dev->txq_len) {
+            uring_submit_tx(loop, dev);
+            break;
+        }
+        if (res > 0)
+            loop_count(&loop->tx_bytes, dev->txq_len);
+        uring_tx_done(dev);
+        break;
+    case URING_RX:
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            if (res > 0)
+                loop_rx(loop, dev, u->bufs + bid * AT_LOOP_URING_BUF_SIZE, res);
+            uring_buf_recycle(u, bid);
+        }
+        if (cqe->flags & IORING_CQE_F_MORE)
+            break;
+        // The read ended, re-arm it unless the device or the port is gone
+        pthread_mutex_lock(&loop->lock);
+        bool removed = dev->io_flags & LOOP_IO_CANCEL;
+        pthread_mutex_unlock(&loop->lock);
+        if (res == -EINVAL && u->multishot && !removed) {
+            u->multishot = false;
+            uring_arm_rx(loop, dev);
+        } else if ((res > 0 || res == -ENOBUFS || res == -EAGAIN || res == -EINTR)
+                   && !removed && !atomic_load(&loop->stop)) {
+            uring_arm_rx(loop, dev);
+        } else {
+            uring_release(dev);
+        }
+        break;
+    }
+}
+
+static void uring_cancel(at_loop* loop, at_loop_dev* dev)
+{
+    struct io_uring_sqe* sqe = uring_sqe(loop);
+
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t)(uintptr_t)dev | URING_RX;
+    sqe->user_data = URING_CANCEL;
+}
+
+static void* uring_thread(void* arg)
+{
+    at_loop* loop = arg;
+    loop_uring* u = &loop->u;
+
+    bool pending = false;
+
+    _in_loop = true;
+    uring_arm_wake(loop);
+    while (!atomic_load(&loop->stop)) {
+        // Take the posted work, all of it goes out in the next enter
+        pthread_mutex_lock(&loop->lock);
+        at_loop_dev* dev = loop->io_head;
+        loop->io_head = NULL;
+        for (at_loop_dev* d = dev; d; d = d->io_next) {
+            unsigned flags = d->io_flags;
+            // Keep CANCEL so a completing read is not re-armed
+            d->io_flags &= LOOP_IO_CANCEL;
+            if (flags & LOOP_IO_CANCEL)
+                uring_cancel(loop, d);
+            else if (flags & LOOP_IO_RX)
+                uring_arm_rx(loop, d);
+            if (flags & LOOP_IO_TX)
+                uring_submit_tx(loop, d);
+        }
+        int timeout = loop->wheel.count ? loop->wheel.tick_ms : -1;
+        loop->sleeping = !pending;
+        pthread_mutex_unlock(&loop->lock);
+
+        // Devices waiting for a round only pick up what has completed
+        uring_enter(loop, !pending, timeout);
+        loop_count(&loop->wakeups, 1);
+
+        pthread_mutex_lock(&loop->lock);
+        loop->sleeping = false;
+        pthread_mutex_unlock(&loop->lock);
+
+        unsigned head = *u->cq_head;
+        unsigned tail = atomic_load_explicit((_Atomic unsigned*)u->cq_tail, memory_order_acquire);
+        for (; head != tail; head++)
+            uring_complete(loop, &u->cqes[head & u->cq_mask]);
+        atomic_store_explicit((_Atomic unsigned*)u->cq_head, head, memory_order_release);
+        pending = loop_schedule(loop);
+
+        pthread_mutex_lock(&loop->lock);
+        ATCmdTimer_advance(&loop->wheel, loop_ms());
+        pthread_mutex_unlock(&loop->lock);
+    }
+    return NULL;
+}
+
+static void uring_teardown(loop_uring* u)
+{
+    if (u->bufs)
+        munmap(u->bufs, AT_LOOP_URING_BUFS * AT_LOOP_URING_BUF_SIZE);
+    if (u->br)
+        munmap(u->br, u->br_len);
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_len);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_len);
+    if (u->sq_ring)
+        munmap(u->sq_ring, u->sq_ring_len);
+    if (u->fd >= 0)
+        close(u->fd);
+}
+
+static int uring_setup(loop_uring* u)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0)
+        return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+        goto fail;
+
+    u->entries = p.sq_entries;
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_len > u->sq_ring_len)
+            u->sq_ring_len = u->cq_ring_len;
+        u->cq_ring_len = u->sq_ring_len;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto fail;
+    }
+
+    u->sq_head = (unsigned*)((char*)u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned*)((char*)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)((char*)u->sq_ring + p.sq_off.ring_mask);
+    unsigned* array = (unsigned*)((char*)u->sq_ring + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    u->cq_head = (unsigned*)((char*)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned*)((char*)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)((char*)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)((char*)u->cq_ring + p.cq_off.cqes);
+
+    // Provided buffer ring shared by every port, Linux 5.19
+    u->br_len = AT_LOOP_URING_BUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = mmap(NULL, AT_LOOP_URING_BUFS * AT_LOOP_URING_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED || u->bufs == MAP_FAILED) {
+        u->br = u->br == MAP_FAILED ? NULL : u->br;
+        u->bufs = u->bufs == MAP_FAILED ? NULL : u->bufs;
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = AT_LOOP_URING_BUFS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto fail;
+    for (unsigned bid = 0; bid < AT_LOOP_URING_BUFS; bid++)
+        uring_buf_recycle(u, bid);
+
+    u->multishot = true;
+    return 0;
+fail:
+    uring_teardown(u);
+    return -1;
+}
+#endif
+
+at_loop *ATCmdLoop_create(int tick_ms)
+{
+    return ATCmdLoop_create_backend(tick_ms, AT_LOOP_EPOLL);
+}
+
+at_loop *ATCmdLoop_create_backend(int tick_ms, at_loop_backend backend)
+{
+    at_loop* loop = calloc(1, sizeof(at_loop));
+    struct epoll_event ev = { EPOLLIN, { NULL } };
+    void* (*thread)(void*) = loop_thread;
+
+    if (!loop)
+        return NULL;
+    loop->backend = backend;
+    loop->epfd = -1;
+    loop->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake < 0)
+        goto fail;
+    if (backend == AT_LOOP_EPOLL) {
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd < 0 || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake, &ev) < 0)
+            goto fail;
+    } else {
+#ifdef ATCMDLOOP_IO_URING
+        if (uring_setup(&loop->u) < 0)
+            goto fail;
+        thread = uring_thread;
+#else
+        goto fail;
+#endif
+    }
+
+    // Recursive so timer callbacks may arm and cancel through the loop
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&loop->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    ATCmdTimer_init(&loop->wheel, tick_ms > 0 ? tick_ms : AT_LOOP_TICK_MS, loop_ms());
+    if (pthread_create(&loop->thread, NULL, thread, loop) == 0)
+        return loop;
+    pthread_mutex_destroy(&loop->lock);
+#ifdef ATCMDLOOP_IO_URING
+    if (backend == AT_LOOP_IO_URING)
+        uring_teardown(&loop->u);
+#endif
+fail:
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    if (loop->wake >= 0)
+        close(loop->wake);
+    free(loop);
+    return NULL;
+}
+
+void ATCmdLoop_destroy(at_loop* loop)
+{
+    atomic_store(&loop->stop, true);
+    loop_wake(loop);
+    pthread_join(loop->thread, NULL);
+    pthread_mutex_destroy(&loop->lock);
+#ifdef ATCMDLOOP_IO_URING
+    if (loop->backend == AT_LOOP_IO_URING)
+        uring_teardown(&loop->u);
+#endif
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    close(loop->wake);
+    free(loop);
+}
+
+int ATCmdLoop_add(at_loop* loop, at_loop_dev* dev, int fd, ATParser* at)
+{
+    struct epoll_event ev;
+
+    dev->at = at;
+    dev->fd = fd;
+    dev->loop = loop;
+    dev->expired = false;
+    dev->deadline.next = NULL;
+    dev->rx_head = 0;
+    dev->rx_tail = 0;
+    dev->rx_limit = 0;
+    dev->rx_dropped = 0;
+    dev->oob_runs = 0;
+    dev->run_next = NULL;
+    dev->queued = false;
+    dev->removed = false;
+    dev->quantum = 0;
+    dev->deficit = 0;
+    dev->cpu_ns = 0;
+    dev->io_next = NULL;
+    dev->io_flags = 0;
+    dev->inflight = 0;
+    dev->tx_busy = false;
+    dev->tx_len = 0;
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_mutex_init(&dev->rx_lock, NULL);
+    pthread_cond_init(&dev->rx_cond, NULL);
+    ATCmdParser_set_priv(at, dev);
+
+    pthread_mutex_lock(&loop->lock);
+    dev->next = loop->devs;
+    loop->devs = dev;
+    pthread_mutex_unlock(&loop->lock);
+
+#ifdef ATCMDLOOP_IO_URING
+    if (loop->backend == AT_LOOP_IO_URING) {
+        dev->inflight = 1;
+        loop_post(loop, dev, LOOP_IO_RX);
+        return 0;
+    }
+#endif
+    ev.events = EPOLLIN;
+    ev.data.ptr = dev;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ATCmdLoop_remove(loop, dev);
+        return -1;
+    }
+    return 0;
+}
+
+void ATCmdLoop_remove(at_loop* loop, at_loop_dev* dev)
+{
+#ifdef ATCMDLOOP_IO_URING
+    if (loop->backend == AT_LOOP_IO_URING) {
+        // The read is owned by the kernel until its final completion
+        loop_post(loop, dev, LOOP_IO_CANCEL);
+        pthread_mutex_lock(&dev->rx_lock);
+        while (dev->inflight > 0 && !atomic_load(&loop->stop))
+            pthread_cond_wait(&dev->rx_cond, &dev->rx_lock);
+        pthread_mutex_unlock(&dev->rx_lock);
+    }
+#endif
+    if (loop->epfd >= 0)
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+
+    pthread_mutex_lock(&loop->lock);
+    ATCmdTimer_cancel(&loop->wheel, &dev->deadline);
+    for (at_loop_dev** p = &loop->devs; *p; p = &(*p)->next) {
+        if (*p == dev) {
+            *p = dev->next;
+            break;
+        }
+    }
+    for (at_loop_dev** p = &loop->io_head; *p; p = &(*p)->io_next) {
+        if (*p == dev) {
+            *p = dev->io_next;
+            break;
+        }
+    }
+    dev->removed = true;
+    if (dev->queued) {
+        at_loop_dev* prev = NULL;
+        for (at_loop_dev* d = loop->run_head; d; prev = d, d = d->run_next) {
+            if (d == dev) {
+                if (prev)
+                    prev->run_next = dev->run_next;
+                else
+                    loop->run_head = dev->run_next;
+                if (loop->run_tail == dev)
+                    loop->run_tail = prev;
+                break;
+            }
+        }
+        dev->queued = false;
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    // The loop may still be dispatching for this device
+    pthread_mutex_lock(&dev->lock);
+    pthread_mutex_lock(&dev->rx_lock);
+    pthread_mutex_unlock(&dev->rx_lock);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_cond_destroy(&dev->rx_cond);
+    pthread_mutex_destroy(&dev->rx_lock);
+    pthread_mutex_destroy(&dev->lock);
+}
+
+void ATCmdLoop_lock(at_loop_dev* dev)
+{
+    pthread_mutex_lock(&dev->lock);
+}
+
+void ATCmdLoop_unlock(at_loop_dev* dev)
+{
+    pthread_mutex_lock(&dev->rx_lock);
+    bool line = dev_has_consumer(dev) && ring_has_line(dev);
+    pthread_mutex_unlock(&dev->rx_lock);
+    if (line)
+        loop_runnable(dev->loop, dev);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+void ATCmdLoop_set_quantum(at_loop_dev* dev, int bytes)
+{
+    dev->quantum = bytes;
+}
+
+void ATCmdLoop_arm(at_loop* loop, at_timer* timer, int delay_ms, at_timer_callback cb, void* arg)
+{
+    at_timer_wheel* w = &loop->wheel;
+    uint32_t now = loop_ms();
+
+    pthread_mutex_lock(&loop->lock);
+    bool idle = w->count == 0;
+    if (idle) {
+        // Fires nothing, only catches the clock up
+        ATCmdTimer_advance(w, now);
+    } else {
+        // Callbacks belong to the loop thread, count the ticks it has yet to process
+        delay_ms += ((now - w->origin_ms) / w->tick_ms + 1 - w->clock) * w->tick_ms;
+    }
+    ATCmdTimer_arm(w, timer, delay_ms, cb, arg);
+    pthread_mutex_unlock(&loop->lock);
+    // The loop sleeps without a timeout while the wheel is empty
+    if (idle && !_in_loop)
+        loop_wake(loop);
+}
+
+void ATCmdLoop_cancel(at_loop* loop, at_timer* timer)
+{
+    pthread_mutex_lock(&loop->lock);
+    ATCmdTimer_cancel(&loop->wheel, timer);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+void ATCmdLoop_get_stats(at_loop* loop, at_loop_stats* stats)
+{
+    stats->syscalls = atomic_load(&loop->syscalls);
+    stats->rx_bytes = atomic_load(&loop->rx_bytes);
+    stats->tx_bytes = atomic_load(&loop->tx_bytes);
+    stats->wakeups = atomic_load(&loop->wakeups);
+}
+
+/* Ring backed serial_ops, the device comes from the parser being driven */
+
+static at_loop_dev* loop_dev(void)
+{
+    return ATCmdParser_priv(ATCmdParser_current());
+}
+
+static void loop_flush(at_loop_dev* dev)
+{
+    at_loop* loop = dev->loop;
+    const char* data = dev->tx;
+    int len = dev->tx_len;
+
+#ifdef ATCMDLOOP_IO_URING
+    if (loop->backend == AT_LOOP_IO_URING && !_in_loop) {
+        // Hand the bytes to the loop, writes of all ports share one submission
+        pthread_mutex_lock(&dev->rx_lock);
+        while (dev->tx_busy)
+            pthread_cond_wait(&dev->rx_cond, &dev->rx_lock);
+        memcpy(dev->txq, dev->tx, len);
+        dev->txq_len = len;
+        dev->txq_off = 0;
+        dev->tx_busy = true;
+        dev->inflight++;
+        pthread_mutex_unlock(&dev->rx_lock);
+        dev->tx_len = 0;
+        loop_post(loop, dev, LOOP_IO_TX);
+        return;
+    }
+#endif
+    loop_count(&loop->tx_bytes, len);
+    while (len > 0) {
+        int n = write(dev->fd, data, len);
+        loop_count(&loop->syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = { dev->fd, POLLOUT, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    dev->tx_len = 0;
+}
+
+// Runs on the loop thread with the wheel locked
+static void loop_deadline(at_timer* timer, void* arg)
+{
+    at_loop_dev* dev = arg;
+
+    (void)timer;
+    pthread_mutex_lock(&dev->rx_lock);
+    dev->expired = true;
+    pthread_cond_signal(&dev->rx_cond);
+    pthread_mutex_unlock(&dev->rx_lock);
+}
+
+static int loop_get(int timeout)
+{
+    at_loop_dev* dev = loop_dev();
+    bool armed = false;
+    int c = -1;
+
+    if (dev->tx_len)
+        loop_flush(dev);
+
+    pthread_mutex_lock(&dev->rx_lock);
+    if (dev->rx_head == dev->rx_tail && timeout > 0 && !_in_loop) {
+        // Never hold rx_lock while taking the wheel lock, see loop_deadline
+        dev->expired = false;
+        pthread_mutex_unlock(&dev->rx_lock);
+        ATCmdLoop_arm(dev->loop, &dev->deadline, timeout, loop_deadline, dev);
+        armed = true;
+        pthread_mutex_lock(&dev->rx_lock);
+        while (dev->rx_head == dev->rx_tail && !dev->expired)
+            pthread_cond_wait(&dev->rx_cond, &dev->rx_lock);
+    }
+    if (dev->rx_head != dev->rx_tail)
+        c = (unsigned char)dev->rx[dev->rx_tail++ & (AT_LOOP_RX_SIZE - 1)];
+    else if (_in_loop)
+        c = AT_GET_AGAIN;
+    pthread_mutex_unlock(&dev->rx_lock);
+
+    if (armed)
+        ATCmdLoop_cancel(dev->loop, &dev->deadline);
+    return c;
+}
+
+// Garbage lines are dropped from the ring without passing through get
+static int loop_skip(char delim)
+{
+    at_loop_dev* dev = loop_dev();
+
+    pthread_mutex_lock(&dev->rx_lock);
+    unsigned tail = dev->rx_tail & (AT_LOOP_RX_SIZE - 1);
+    unsigned used = ring_used(dev);
+    unsigned first = used < AT_LOOP_RX_SIZE - tail ? used : AT_LOOP_RX_SIZE - tail;
+    const char* p = memchr(dev->rx + tail, delim, first);
+    unsigned n;
+    if (p) {
+        n = p - (dev->rx + tail);
+    } else {
+        p = memchr(dev->rx, delim, used - first);
+        n = p ? first + (p - dev->rx) : used;
+    }
+    dev->rx_tail += n;
+    pthread_mutex_unlock(&dev->rx_lock);
+    return n;
+}
+
+static int loop_put(char c)
+{
+    at_loop_dev* dev = loop_dev();
+
+    if (dev->tx_len == AT_LOOP_TX_SIZE)
+        loop_flush(dev);
+    dev->tx[dev->tx_len++] = c;
+    return 0;
+}
+
+static int loop_readable()
+{
+    at_loop_dev* dev = loop_dev();
+
+    if (dev->tx_len)
+        loop_flush(dev);
+    pthread_mutex_lock(&dev->rx_lock);
+    bool avail = dev->rx_head != dev->rx_tail;
+    pthread_mutex_unlock(&dev->rx_lock);
+    return avail;
+}
+
+static int loop_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static void loop_delay(int ms)
+{
+    at_loop_dev* dev = loop_dev();
+
+    if (dev && dev->tx_len)
+        loop_flush(dev);
+    usleep(ms * 1000);
+}
+
+static uint32_t loop_tick(void)
+{
+    return loop_ms();
+}
+
+serial_ops at_loop_ops = { loop_get, loop_put, loop_readable, loop_init, loop_delay, loop_tick, loop_skip };
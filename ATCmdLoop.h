@@ -0,0 +1,203 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdLoop.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_LOOP_H_
+#define _AT_CMD_LOOP_H_
+
+#include <pthread.h>
+
+#include "ATCmdParser.h"
+#include "ATCmdTimer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_LOOP_RX_SIZE		(8192)	/* per-device RX ring, power of two */
+#define AT_LOOP_TX_SIZE		(2048)
+#define AT_LOOP_TICK_MS		(10)	/* default timer wheel resolution */
+#define AT_LOOP_URING_BUFS	(64)	/* provided RX buffers of the io_uring backend */
+#define AT_LOOP_URING_BUF_SIZE	(4096)
+#define AT_LOOP_QUANTUM		(512)	/* default bytes a device may dispatch per scheduling round */
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct at_loop at_loop;
+
+/**
+ * Port I/O mechanism of a loop
+ */
+typedef enum {
+    AT_LOOP_EPOLL = 0,		/* readiness events, one read per ready port */
+    AT_LOOP_IO_URING,		/* multishot reads into provided buffers, writes batched
+                               into one submission; needs -DATCMDLOOP_IO_URING */
+} at_loop_backend;
+
+/**
+ * Loop counters, see #ATCmdLoop_get_stats
+ */
+typedef struct {
+    uint64_t syscalls;      /* by the loop thread and by ring ops doing port I/O */
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t wakeups;       /* loop iterations */
+} at_loop_stats;
+
+/**
+ * Device served by the loop, storage belongs to the caller. The parser priv
+ * points here, so #at_loop_ops finds its ring; use user for own data.
+ */
+typedef struct at_loop_dev {
+    ATParser* at;
+    int fd;
+    void* user;
+    at_loop* loop;
+    struct at_loop_dev* next;
+    pthread_mutex_t lock;           /* held by the thread driving the parser */
+    pthread_mutex_t rx_lock;
+    pthread_cond_t rx_cond;
+    bool expired;                   /* get() deadline passed */
+    at_timer deadline;
+    unsigned rx_head;               /* free running, written by the loop */
+    unsigned rx_tail;               /* free running, read by the parser */
+    unsigned rx_limit;              /* end of the complete lines being dispatched */
+    uint32_t rx_dropped;            /* bytes lost to a full ring */
+    uint32_t oob_runs;              /* idle out-of-band processing by the loop */
+    struct at_loop_dev* run_next;   /* devices with complete lines, under the loop lock */
+    bool queued;
+    bool removed;
+    int quantum;                    /* bytes per round, 0: #AT_LOOP_QUANTUM */
+    int deficit;
+    uint64_t cpu_ns;                /* loop thread CPU spent dispatching for this device */
+    struct at_loop_dev* io_next;    /* io_uring: pending loop work, under the loop lock */
+    unsigned io_flags;
+    int inflight;                   /* io_uring: requests owned by the kernel */
+    bool tx_busy;                   /* io_uring: txq handed to the loop */
+    int txq_len;
+    int txq_off;
+    int tx_len;
+    char tx[AT_LOOP_TX_SIZE];
+    char txq[AT_LOOP_TX_SIZE];
+    char rx[AT_LOOP_RX_SIZE];
+} at_loop_dev;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Start an epoll loop thread reading many serial ports into
+ *                  per-device RX rings. get() deadlines of every parser and
+ *                  caller timers share one timer wheel, so the loop wakes at
+ *                  most once per tick however many deadlines are armed.
+ *
+ * @param[in] 		tick_ms: timer resolution, 0 for #AT_LOOP_TICK_MS
+ *
+ * @return 			loop, NULL on error
+ */
+at_loop *ATCmdLoop_create(int tick_ms);
+
+/**
+ * @brief 			Like #ATCmdLoop_create with a choice of I/O backend
+ *
+ * @return 			loop, NULL on error or backend not built in or not
+ *                  supported by the kernel
+ */
+at_loop *ATCmdLoop_create_backend(int tick_ms, at_loop_backend backend);
+
+/**
+ * @brief 			Stop the loop thread and free the loop, devices must be removed
+ */
+void ATCmdLoop_destroy(at_loop* loop);
+
+/**
+ * @brief 			Serve a parser created with #at_loop_ops on a non-blocking fd
+ *
+ * @param[in] 		dev: device storage, must stay valid until removed
+ * @param[in] 		fd: tty or socket, set to non-blocking
+ * @param[in] 		at: parser, its priv is set to dev
+ *
+ * @return 			0: Success, -1: epoll error
+ */
+int ATCmdLoop_add(at_loop* loop, at_loop_dev* dev, int fd, ATParser* at);
+
+void ATCmdLoop_remove(at_loop* loop, at_loop_dev* dev);
+
+/**
+ * @brief 			Take the device before sending commands; while nobody holds
+ *                  it the loop dispatches complete lines itself when the parser
+ *                  has out-of-band handlers, a line callback or an unprocessed
+ *                  data hook. Handlers run there read what the ring holds and
+ *                  get #AT_GET_AGAIN instead of waiting for more
+ */
+void ATCmdLoop_lock(at_loop_dev* dev);
+
+/**
+ * @brief 			Release the device, lines left in its ring are queued for
+ *                  the loop to dispatch
+ */
+void ATCmdLoop_unlock(at_loop_dev* dev);
+
+/**
+ * @brief 			Weight of a device in the loop's dispatching: devices with
+ *                  complete lines take turns, each handling up to its quantum of
+ *                  received bytes per round (deficit round robin), so a URC storm
+ *                  or a data stream on one port cannot hold up the others
+ *
+ * @param[in] 		bytes: quantum, 0 for #AT_LOOP_QUANTUM
+ *
+ * @return 			none
+ */
+void ATCmdLoop_set_quantum(at_loop_dev* dev, int bytes);
+
+/**
+ * @brief 			Arm a timer on the loop wheel, e.g. a URC coalescing window,
+ *                  the callback runs on the loop thread
+ *
+ * @return 			none
+ */
+void ATCmdLoop_arm(at_loop* loop, at_timer* timer, int delay_ms, at_timer_callback cb, void* arg);
+
+void ATCmdLoop_cancel(at_loop* loop, at_timer* timer);
+
+void ATCmdLoop_get_stats(at_loop* loop, at_loop_stats* stats);
+
+/**
+ * Ring backed serial port for parsers served by a loop
+ */
+extern serial_ops at_loop_ops;
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_LOOP_H_
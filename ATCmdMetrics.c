@@ -0,0 +1,313 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdMetrics.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ATCmdMetrics.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+    bool wide;
+} metric_counter;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+#define COUNTER(name, field, help) \
+    { name, help, offsetof(ATParserStats, field), sizeof(((ATParserStats*)0)->field) == 8 }
+
+static const metric_counter counters[] = {
+    COUNTER("atcmd_rx_bytes", rx_bytes, "Bytes received from the modem."),
+    COUNTER("atcmd_tx_bytes", tx_bytes, "Bytes sent to the modem."),
+    COUNTER("atcmd_lines", lines, "Complete lines received."),
+    COUNTER("atcmd_timeouts", timeouts, "recv and getline timeouts."),
+    COUNTER("atcmd_restarts", restarts, "recv matches restarted by out-of-band packets."),
+    COUNTER("atcmd_garbage_lines", garbage_lines, "Binary or overlong lines discarded."),
+    COUNTER("atcmd_garbage_bytes", garbage_bytes, "Bytes of discarded lines."),
+    COUNTER("atcmd_breaker_opens", breaker_opens, "Circuit breaker openings."),
+    COUNTER("atcmd_breaker_rejects", breaker_rejects, "Commands failed by an open breaker."),
+    COUNTER("atcmd_txns", txns, "Timed transactions."),
+    COUNTER("atcmd_txn_tx_nanoseconds", txn_tx_ns, "Timed transactions: writing commands."),
+    COUNTER("atcmd_txn_wait_nanoseconds", txn_wait_ns, "Timed transactions: waiting for the modem's first byte."),
+    COUNTER("atcmd_txn_rx_nanoseconds", txn_rx_ns, "Timed transactions: receiving responses."),
+    COUNTER("atcmd_txn_match_nanoseconds", txn_match_ns, "Timed transactions: response matcher."),
+    COUNTER("atcmd_txn_oob_nanoseconds", txn_oob_ns, "Timed transactions: out-of-band handlers."),
+};
+
+static const uint32_t latency_bounds[] = AT_STATS_LATENCY_BOUNDS_MS;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+void ATCmdMetrics_init(at_metrics* m, at_metrics_dev* devs, int max)
+{
+    m->devs = devs;
+    m->ndevs = 0;
+    m->max = max;
+    m->listen_fd = -1;
+    m->socket_path = NULL;
+    m->scrapes = 0;
+}
+
+bool ATCmdMetrics_add(at_metrics* m, const char* name, ATParser *at, at_loop_dev* dev)
+{
+    if (m->ndevs == m->max)
+        return false;
+    m->devs[m->ndevs].name = name;
+    m->devs[m->ndevs].at = at;
+    m->devs[m->ndevs].dev = dev;
+    m->ndevs++;
+    return true;
+}
+
+// Label value with backslash, quote and newline escaped
+static void put_label(FILE* out, const char* value)
+{
+    for (; *value; value++) {
+        if (*value == '\\' || *value == '"')
+            fputc('\\', out);
+        if (*value == '\n')
+            fputs("\\n", out);
+        else
+            fputc(*value, out);
+    }
+}
+
+static void put_device(FILE* out, const char* metric, const at_metrics_dev* d)
+{
+    fprintf(out, "%s{device=\"", metric);
+    put_label(out, d->name);
+    fputc('"', out);
+}
+
+static void put_latency(FILE* out, const at_metrics_dev* d, const ATParserStats* st)
+{
+    uint64_t count = 0;
+
+    for (int k = 0; k < AT_STATS_LATENCY_BUCKETS; k++) {
+        count += st->recv_latency[k];
+        put_device(out, "atcmd_recv_latency_seconds_bucket", d);
+        if (k < AT_STATS_LATENCY_BUCKETS - 1)
+            fprintf(out, ",le=\"%g\"} %llu\n", latency_bounds[k] / 1000.0, (unsigned long long)count);
+        else
+            fprintf(out, ",le=\"+Inf\"} %llu\n", (unsigned long long)count);
+    }
+    put_device(out, "atcmd_recv_latency_seconds_sum", d);
+    fprintf(out, "} %.9f\n", st->recv_latency_ns / 1e9);
+    put_device(out, "atcmd_recv_latency_seconds_count", d);
+    fprintf(out, "} %llu\n", (unsigned long long)count);
+}
+
+bool ATCmdMetrics_write(at_metrics* m, FILE* out)
+{
+    // One snapshot per device so every family reports the same instant
+    ATParserStats* snap = malloc(sizeof(ATParserStats) * (m->ndevs ? m->ndevs : 1));
+    if (!snap)
+        return false;
+    for (int i = 0; i < m->ndevs; i++)
+        ATCmdParser_get_stats(m->devs[i].at, &snap[i]);
+
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+        fprintf(out, "# TYPE %s counter\n# HELP %s %s\n", counters[c].name, counters[c].name, counters[c].help);
+        for (int i = 0; i < m->ndevs; i++) {
+            const char* field = (const char*)&snap[i] + counters[c].offset;
+            unsigned long long v = counters[c].wide ? *(const uint64_t*)field : *(const uint32_t*)field;
+            fprintf(out, "%s_total{device=\"", counters[c].name);
+            put_label(out, m->devs[i].name);
+            fprintf(out, "\"} %llu\n", v);
+        }
+    }
+
+    fputs("# TYPE atcmd_oob_hits counter\n# HELP atcmd_oob_hits Out-of-band packets dispatched per prefix.\n", out);
+    for (int i = 0; i < m->ndevs; i++) {
+        for (int k = 0; k < AT_STATS_MAX_OOB && snap[i].oob_hits[k].prefix; k++) {
+            put_device(out, "atcmd_oob_hits_total", &m->devs[i]);
+            fputs(",prefix=\"", out);
+            put_label(out, snap[i].oob_hits[k].prefix);
+            fprintf(out, "\"} %u\n", snap[i].oob_hits[k].hits);
+        }
+        if (snap[i].oob_other) {
+            put_device(out, "atcmd_oob_hits_total", &m->devs[i]);
+            fprintf(out, ",prefix=\"\"} %u\n", snap[i].oob_other);
+        }
+    }
+
+    fputs("# TYPE atcmd_recv_latency_seconds histogram\n# HELP atcmd_recv_latency_seconds Duration of successful recv calls.\n", out);
+    for (int i = 0; i < m->ndevs; i++)
+        put_latency(out, &m->devs[i], &snap[i]);
+
+    fputs("# TYPE atcmd_rx_queue_bytes gauge\n# HELP atcmd_rx_queue_bytes Received bytes not yet parsed.\n", out);
+    for (int i = 0; i < m->ndevs; i++) {
+        const at_loop_dev* dev = m->devs[i].dev;
+        if (!dev)
+            continue;
+        // Racy reads of the loop's counters, a snapshot may be off by a batch
+        put_device(out, "atcmd_rx_queue_bytes", &m->devs[i]);
+        fprintf(out, "} %u\n", dev->rx_head - dev->rx_tail);
+    }
+    fputs("# TYPE atcmd_tx_queue_bytes gauge\n# HELP atcmd_tx_queue_bytes Bytes queued for the modem.\n", out);
+    for (int i = 0; i < m->ndevs; i++) {
+        const at_loop_dev* dev = m->devs[i].dev;
+        if (!dev)
+            continue;
+        put_device(out, "atcmd_tx_queue_bytes", &m->devs[i]);
+        fprintf(out, "} %d\n", dev->tx_len + dev->txq_len - dev->txq_off);
+    }
+    fputs("# TYPE atcmd_rx_dropped_bytes counter\n# HELP atcmd_rx_dropped_bytes Bytes lost to a full RX ring.\n", out);
+    for (int i = 0; i < m->ndevs; i++) {
+        const at_loop_dev* dev = m->devs[i].dev;
+        if (!dev)
+            continue;
+        put_device(out, "atcmd_rx_dropped_bytes_total", &m->devs[i]);
+        fprintf(out, "} %u\n", dev->rx_dropped);
+    }
+    fputs("# TYPE atcmd_loop_cpu_seconds counter\n# HELP atcmd_loop_cpu_seconds Loop thread CPU spent dispatching for the device.\n", out);
+    for (int i = 0; i < m->ndevs; i++) {
+        const at_loop_dev* dev = m->devs[i].dev;
+        if (!dev)
+            continue;
+        put_device(out, "atcmd_loop_cpu_seconds_total", &m->devs[i]);
+        fprintf(out, "} %.9f\n", dev->cpu_ns / 1e9);
+    }
+    fputs("# EOF\n", out);
+
+    free(snap);
+    return fflush(out) == 0 && !ferror(out);
+}
+
+bool ATCmdMetrics_write_file(at_metrics* m, const char* path)
+{
+    char tmp[PATH_MAX];
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmp))
+        return false;
+    FILE* out = fopen(tmp, "w");
+    if (!out)
+        return false;
+
+    bool ok = ATCmdMetrics_write(m, out);
+    ok = fsync(fileno(out)) == 0 && ok;
+    ok = fclose(out) == 0 && ok;
+    if (ok && rename(tmp, path) == 0)
+        return true;
+    unlink(tmp);
+    return false;
+}
+
+bool ATCmdMetrics_listen(at_metrics* m, const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return false;
+    }
+    m->listen_fd = fd;
+    m->socket_path = path;
+    return true;
+}
+
+// Hand the whole snapshot to the kernel at once or give up on the scraper
+static bool serve_one(at_metrics* m, int fd)
+{
+    char* buf = NULL;
+    size_t len = 0;
+    size_t off = 0;
+    FILE* out = open_memstream(&buf, &len);
+
+    if (!out)
+        return false;
+    bool ok = ATCmdMetrics_write(m, out);
+    ok = fclose(out) == 0 && ok;
+    if (ok) {
+        // Room for the whole snapshot, only a scraper that stopped reading hits EAGAIN
+        int sndbuf = len;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        while (off < len) {
+            ssize_t n = send(fd, buf + off, len - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR)
+                continue;
+            // EAGAIN: scraper not reading, EPIPE: gone, drop it either way
+            if (n <= 0)
+                break;
+            off += n;
+        }
+    }
+    free(buf);
+    return ok && off == len;
+}
+
+int ATCmdMetrics_serve(at_metrics* m)
+{
+    int served = 0;
+
+    if (m->listen_fd < 0)
+        return 0;
+    while (true) {
+        int fd = accept4(m->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (serve_one(m, fd)) {
+            m->scrapes++;
+            served++;
+        }
+        close(fd);
+    }
+    return served;
+}
+
+void ATCmdMetrics_close(at_metrics* m)
+{
+    if (m->listen_fd < 0)
+        return;
+    close(m->listen_fd);
+    unlink(m->socket_path);
+    m->listen_fd = -1;
+}
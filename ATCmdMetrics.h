@@ -0,0 +1,129 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdMetrics.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_METRICS_H_
+#define _AT_CMD_METRICS_H_
+
+#include "ATCmdParser.h"
+#include "ATCmdLoop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    const char* name;               /* "device" label */
+    ATParser* at;
+    at_loop_dev* dev;               /* optional: adds RX ring and TX queue depths */
+} at_metrics_dev;
+
+/**
+ * OpenMetrics exporter over a caller-provided device table
+ */
+typedef struct {
+    at_metrics_dev* devs;
+    int ndevs;
+    int max;
+    int listen_fd;
+    const char* socket_path;
+    uint32_t scrapes;
+} at_metrics;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Exporter over storage for up to max devices
+ *
+ * @return 			none
+ */
+void ATCmdMetrics_init(at_metrics* m, at_metrics_dev* devs, int max);
+
+/**
+ * @brief 			Export a parser, name must stay valid
+ *
+ * @param[in] 		dev: loop device of the parser, may be NULL
+ *
+ * @return 			true: Success, false: Table full
+ */
+bool ATCmdMetrics_add(at_metrics* m, const char* name, ATParser *at, at_loop_dev* dev);
+
+/**
+ * @brief 			Write all devices in OpenMetrics text format. Counters are
+ *                  copied without locking, so the parsers' threads are never held
+ *                  up; see #ATCmdParser_get_stats, on 32-bit targets a 64-bit
+ *                  counter may be torn and a scrape can show it going backwards
+ *
+ * @return 			true: Success, false: Write error
+ */
+bool ATCmdMetrics_write(at_metrics* m, FILE* out);
+
+/**
+ * @brief 			Write a textfile collector file, readers see either the
+ *                  previous or the new content via rename
+ *
+ * @return 			true: Success, false: File error
+ */
+bool ATCmdMetrics_write_file(at_metrics* m, const char* path);
+
+/**
+ * @brief 			Listen on a Unix stream socket, replacing a stale one; every
+ *                  connection gets one snapshot, see #ATCmdMetrics_serve
+ *
+ * @return 			true: Success, false: Socket error
+ */
+bool ATCmdMetrics_listen(at_metrics* m, const char* path);
+
+/**
+ * @brief 			Answer pending scrapes without waiting for new ones, call it
+ *                  from any thread but the parsers' when the socket is readable.
+ *                  Each snapshot is rendered in memory and sent without blocking,
+ *                  a scraper that is gone or not reading is dropped
+ *
+ * @return 			scrapes answered
+ */
+int ATCmdMetrics_serve(at_metrics* m);
+
+/**
+ * @brief 			Listening socket for poll/epoll, -1 if not listening
+ */
+static inline int ATCmdMetrics_fd(at_metrics* m)
+{
+    return m->listen_fd;
+}
+
+void ATCmdMetrics_close(at_metrics* m);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_METRICS_H_
@@ -0,0 +1,159 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdMultiPort.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include "ATCmdMultiPort.h"
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+void ATCmdMultiPort_init(at_mport* mp, ATParser* const ats[], int n)
+{
+    if (n > AT_MPORT_MAX_PORTS)
+        n = AT_MPORT_MAX_PORTS;
+    mp->nports = n;
+    atomic_init(&mp->next, 0);
+    pthread_mutex_init(&mp->lock, NULL);
+    mp->npins = 0;
+    mp->noobs = 0;
+    for (int i = 0; i < n; i++) {
+        mp->ports[i].at = ats[i];
+        pthread_mutex_init(&mp->ports[i].lock, NULL);
+        atomic_init(&mp->ports[i].load, 0);
+        mp->ports[i].commands = 0;
+    }
+}
+
+void ATCmdMultiPort_deinit(at_mport* mp)
+{
+    for (int i = 0; i < mp->nports; i++)
+        pthread_mutex_destroy(&mp->ports[i].lock);
+    pthread_mutex_destroy(&mp->lock);
+}
+
+static int mport_least_loaded(at_mport* mp)
+{
+    unsigned start = atomic_fetch_add_explicit(&mp->next, 1, memory_order_relaxed);
+    int best = start % mp->nports;
+    int best_load = atomic_load_explicit(&mp->ports[best].load, memory_order_relaxed);
+
+    for (int k = 1; k < mp->nports && best_load > 0; k++) {
+        int i = (start + k) % mp->nports;
+        int load = atomic_load_explicit(&mp->ports[i].load, memory_order_relaxed);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Port of a group, pinned to the least loaded port on first use
+static int mport_pin(at_mport* mp, const char* group)
+{
+    int port = -1;
+
+    pthread_mutex_lock(&mp->lock);
+    for (int i = 0; i < mp->npins; i++) {
+        if (strncmp(mp->pins[i].group, group, AT_MPORT_GROUP_LEN - 1) == 0) {
+            port = mp->pins[i].port;
+            break;
+        }
+    }
+    if (port < 0) {
+        port = mport_least_loaded(mp);
+        // A full table still routes, the group just is not remembered
+        if (mp->npins < AT_MPORT_MAX_PINS) {
+            strncpy(mp->pins[mp->npins].group, group, AT_MPORT_GROUP_LEN - 1);
+            mp->pins[mp->npins].group[AT_MPORT_GROUP_LEN - 1] = 0;
+            mp->pins[mp->npins].port = port;
+            mp->npins++;
+        }
+    }
+    pthread_mutex_unlock(&mp->lock);
+    return port;
+}
+
+ATParser *ATCmdMultiPort_acquire(at_mport* mp, const char* group)
+{
+    int port = group ? mport_pin(mp, group) : mport_least_loaded(mp);
+    at_mport_port* p = &mp->ports[port];
+
+    atomic_fetch_add_explicit(&p->load, 1, memory_order_relaxed);
+    pthread_mutex_lock(&p->lock);
+    p->commands++;
+    return p->at;
+}
+
+void ATCmdMultiPort_release(at_mport* mp, ATParser *at)
+{
+    for (int i = 0; i < mp->nports; i++) {
+        at_mport_port* p = &mp->ports[i];
+        if (p->at == at) {
+            pthread_mutex_unlock(&p->lock);
+            atomic_fetch_sub_explicit(&p->load, 1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void ATCmdMultiPort_unpin(at_mport* mp, const char* group)
+{
+    pthread_mutex_lock(&mp->lock);
+    for (int i = 0; i < mp->npins; i++) {
+        if (strncmp(mp->pins[i].group, group, AT_MPORT_GROUP_LEN - 1) == 0) {
+            mp->pins[i] = mp->pins[--mp->npins];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mp->lock);
+}
+
+bool ATCmdMultiPort_add_oob(at_mport* mp, const char* prefix, oob_callback cb, void* arg)
+{
+    if (mp->noobs == AT_MPORT_MAX_OOBS)
+        return false;
+    for (int i = 0; i < mp->nports; i++)
+        ATCmdParser_add_oob_arg(mp->ports[i].at, &mp->oobs[mp->noobs][i], prefix, cb, arg);
+    mp->noobs++;
+    return true;
+}
+
+void ATCmdMultiPort_set_line_cb(at_mport* mp, void (*cb)(void *, void *, const char *, int), void* arg)
+{
+    for (int i = 0; i < mp->nports; i++)
+        ATCmdParser_set_line_cb(mp->ports[i].at, cb, arg);
+}
+
+int ATCmdMultiPort_poll(at_mport* mp)
+{
+    int count = 0;
+
+    for (int i = 0; i < mp->nports; i++) {
+        at_mport_port* p = &mp->ports[i];
+        if (pthread_mutex_trylock(&p->lock) != 0)
+            continue;
+        while (ATCmdParser_process_oob(p->at))
+            count++;
+        pthread_mutex_unlock(&p->lock);
+    }
+    return count;
+}
@@ -0,0 +1,136 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdMultiPort.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_MULTI_PORT_H_
+#define _AT_CMD_MULTI_PORT_H_
+
+#include <pthread.h>
+
+#include "ATCmdAtomic.h"
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_MPORT_MAX_PORTS	(4)
+#define AT_MPORT_MAX_PINS	(16)
+#define AT_MPORT_MAX_OOBS	(16)
+#define AT_MPORT_GROUP_LEN	(16)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    ATParser* at;
+    pthread_mutex_t lock;           /* held while a caller uses the port */
+    at_atomic_int load;             /* holders and waiters */
+    uint32_t commands;              /* acquisitions */
+} at_mport_port;
+
+/**
+ * Several AT ports of one modem behind one handle
+ */
+typedef struct {
+    int nports;
+    at_atomic_uint next;            /* round robin start among equally loaded ports */
+    pthread_mutex_t lock;           /* pin table */
+    struct {
+        char group[AT_MPORT_GROUP_LEN];
+        int port;
+    } pins[AT_MPORT_MAX_PINS];
+    int npins;
+    int noobs;
+    struct oob oobs[AT_MPORT_MAX_OOBS][AT_MPORT_MAX_PORTS];
+    at_mport_port ports[AT_MPORT_MAX_PORTS];
+} at_mport;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Group the parsers of one modem's AT interfaces
+ *
+ * @param[in] 		ats: parsers, one per port
+ * @param[in] 		n: number of parsers, at most #AT_MPORT_MAX_PORTS
+ *
+ * @return 			none
+ */
+void ATCmdMultiPort_init(at_mport* mp, ATParser* const ats[], int n);
+
+void ATCmdMultiPort_deinit(at_mport* mp);
+
+/**
+ * @brief 			Take a port for a transaction: the least loaded one, or for a
+ *                  named group the port the group was first run on, so stateful
+ *                  sequences (sockets opened with +QIOPEN, SMS in text mode,
+ *                  file handles) always see the same port
+ *
+ * @param[in] 		group: stateful command group, NULL for stateless commands
+ *
+ * @return 			parser of the port, held until #ATCmdMultiPort_release
+ */
+ATParser *ATCmdMultiPort_acquire(at_mport* mp, const char* group);
+
+void ATCmdMultiPort_release(at_mport* mp, ATParser *at);
+
+/**
+ * @brief 			Forget a group's port, its next use picks the least loaded
+ */
+void ATCmdMultiPort_unpin(at_mport* mp, const char* group);
+
+/**
+ * @brief 			Register an out-of-band handler on every port so URCs are
+ *                  handled whichever port the modem reports them on; the handler
+ *                  gets the reporting parser, arg through #ATCmdParser_oob_arg
+ *
+ * @return 			true: Success, false: #AT_MPORT_MAX_OOBS reached
+ */
+bool ATCmdMultiPort_add_oob(at_mport* mp, const char* prefix, oob_callback cb, void* arg);
+
+/**
+ * @brief 			Merge the lines no handler claimed of every port into one callback
+ */
+void ATCmdMultiPort_set_line_cb(at_mport* mp, void (*cb)(void *, void *, const char *, int), void* arg);
+
+/**
+ * @brief 			Dispatch pending URCs on the ports nobody holds
+ *
+ * @return 			number of packets processed
+ */
+int ATCmdMultiPort_poll(at_mport* mp);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_MULTI_PORT_H_
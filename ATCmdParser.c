@@ -19,6 +19,14 @@
  ******************************************************************************
  */
 
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <limits.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#define AT_SYSTEM_CLOCK
+#endif
+
 #include "ATCmdParser.h"
 
 /******************************************************************************
@@ -39,10 +47,38 @@
 #define CR 13
 #endif
 
+/* Static tracepoints for bpftrace/perf, built with -DATCMDPARSER_USDT:
+   provider "atcmdparser", probes send__start(at, fmt, tpl), send__end(at, len, ok),
+   line(at, line, len), match(at, fmt, len), nomatch(at, fmt, len),
+   oob(at, prefix, len), timeout(at, ms), restart(at) */
+#if defined(ATCMDPARSER_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AT_TRACE(probe, ...) STAP_PROBEV(atcmdparser, probe, __VA_ARGS__)
+#endif
+#endif
+#ifndef AT_TRACE
+#define AT_TRACE(probe, ...) do { } while (0)
+#endif
+
+// fast_match() result for formats it cannot handle
+#define FAST_UNSUPPORTED (-2)
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define AT_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define AT_THREAD_LOCAL __thread
+#else
+#define AT_THREAD_LOCAL
+#endif
+
 /******************************************************************************
  *                              Variable Definitions
  ******************************************************************************/
 
+// Parser whose serial port is being driven by this thread
+static AT_THREAD_LOCAL ATParser* _current;
+
 /******************************************************************************
  *                              Function Definitions
  ******************************************************************************/
@@ -57,12 +93,523 @@ static inline void debug_if(int condition, const char* format, ...)
     }
 }
 
+static uint64_t at_now_ns(ATParser *at)
+{
+#ifdef AT_SYSTEM_CLOCK
+    struct timespec ts;
+    (void)at;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    return at->ops->tick ? (uint64_t)at->ops->tick() * 1000000ull : 0;
+#endif
+}
+
+static uint32_t at_now_ms(ATParser *at)
+{
+    if (at->ops->tick)
+        return at->ops->tick();
+    return (uint32_t)(at_now_ns(at) / 1000000ull);
+}
+
+static inline int at_get(ATParser *at, int timeout)
+{
+    int c = at->ops->get(timeout);
+    if (c >= 0)
+        at->stats.rx_bytes++;
+    at->_again = c == AT_GET_AGAIN;
+    return c;
+}
+
+static void stats_latency(ATParser *at, uint64_t ns)
+{
+    static const uint32_t bounds[] = AT_STATS_LATENCY_BOUNDS_MS;
+    uint32_t ms = ns / 1000000ull;
+    int k = 0;
+
+    while (k < AT_STATS_LATENCY_BUCKETS - 1 && ms >= bounds[k])
+        k++;
+    at->stats.recv_latency[k]++;
+    at->stats.recv_latency_ns += ns;
+}
+
+static void stats_oob(ATParser *at, const char* prefix)
+{
+    for (int k = 0; k < AT_STATS_MAX_OOB; k++) {
+        if (at->stats.oob_hits[k].prefix == prefix || !at->stats.oob_hits[k].prefix) {
+            at->stats.oob_hits[k].prefix = prefix;
+            at->stats.oob_hits[k].hits++;
+            return;
+        }
+    }
+    at->stats.oob_other++;
+}
+
+static void observe_sent(ATParser *at, const char* cmd)
+{
+    for (struct at_observer* o = at->_observers; o; o = o->next) {
+        if (o->sent)
+            o->sent(o->arg, cmd);
+    }
+}
+
+// Lines go out without their delimiter, the empty ones around responses not at all
+static void observe_line(ATParser *at, const char* line, int len)
+{
+    while (len > 0 && (line[len - 1] == CR || line[len - 1] == LF))
+        len--;
+    if (len == 0)
+        return;
+    for (struct at_observer* o = at->_observers; o; o = o->next) {
+        if (o->line)
+            o->line(o->arg, line, len);
+    }
+}
+
+// Close the previous transaction into the stats and maybe time this one
+static void txn_begin(ATParser *at)
+{
+    if (at->_txn_timed) {
+        at->stats.txns++;
+        at->stats.txn_tx_ns += at->_txn.tx_ns;
+        at->stats.txn_wait_ns += at->_txn.wait_ns;
+        at->stats.txn_rx_ns += at->_txn.rx_ns;
+        at->stats.txn_match_ns += at->_txn.match_ns;
+        at->stats.txn_oob_ns += at->_txn.oob_ns;
+    }
+    at->_txn_timed = at->_txn_every && ++at->_txn_seq % at->_txn_every == 0;
+    if (!at->_txn_timed)
+        return;
+    memset(&at->_txn, 0, sizeof(at_txn_timing));
+    at->_txn.start_ns = at_now_ns(at);
+    at->_txn_sent = 0;
+    at->_txn_got = false;
+}
+
+// The remainder once the measured phases are taken out is receive time
+static void txn_end(ATParser *at, bool ok)
+{
+    at_txn_timing* t = &at->_txn;
+
+    if (!at->_txn_timed)
+        return;
+    t->ok = ok;
+    t->total_ns = at_now_ns(at) - t->start_ns;
+    uint64_t known = t->tx_ns + t->wait_ns + t->match_ns + t->oob_ns;
+    t->rx_ns = t->total_ns > known ? t->total_ns - known : 0;
+}
+
+// First byte of the response, the wait since the command went out ends here
+static inline void txn_got(ATParser *at)
+{
+    if (at->_txn_got)
+        return;
+    at->_txn_got = true;
+    if (at->_txn_sent)
+        at->_txn.wait_ns = at_now_ns(at) - at->_txn_sent;
+}
+
+/* Circuit breaker gate for commands, false: fail without touching the port */
+static bool breaker_allow(ATParser *at)
+{
+    at_breaker* br = &at->_breaker;
+
+    if (br->threshold <= 0 || br->state != AT_BREAKER_OPEN)
+        return true;
+    if ((int32_t)(at_now_ms(at) - br->opened_at) < br->backoff_ms) {
+        at->stats.breaker_rejects++;
+        debug_if(at->_dbg_on, "AT(Breaker open)\n");
+        return false;
+    }
+    br->state = AT_BREAKER_HALF_OPEN;
+    at->stats.breaker_probes++;
+    return true;
+}
+
+static void breaker_timeout(ATParser *at)
+{
+    at_breaker* br = &at->_breaker;
+
+    // The port could not wait, the modem is not to blame
+    if (at->_again)
+        return;
+    at->stats.timeouts++;
+    if (br->threshold <= 0)
+        return;
+    if (br->state == AT_BREAKER_HALF_OPEN) {
+        // Failed probe, back off further
+        br->backoff_ms = br->backoff_ms > br->max_open_ms / 2 ? br->max_open_ms : br->backoff_ms * 2;
+    } else if (br->state == AT_BREAKER_CLOSED && ++br->failures >= br->threshold) {
+        br->backoff_ms = br->open_ms;
+    } else {
+        return;
+    }
+    br->state = AT_BREAKER_OPEN;
+    br->opened_at = at_now_ms(at);
+    at->stats.breaker_opens++;
+    debug_if(at->_dbg_on, "AT(Breaker open %d ms)\n", br->backoff_ms);
+}
+
+// The modem produced a line, so it is alive
+static inline void breaker_alive(ATParser *at)
+{
+    at_breaker* br = &at->_breaker;
+
+    br->failures = 0;
+    if (br->state == AT_BREAKER_HALF_OPEN) {
+        br->state = AT_BREAKER_CLOSED;
+        at->stats.breaker_closes++;
+        debug_if(at->_dbg_on, "AT(Breaker closed)\n");
+    }
+}
+
+static int scan_digits(const char* in, int pos, int lim, int base)
+{
+    for (; pos < lim; pos++) {
+        int c = in[pos];
+        int v = (c >= '0' && c <= '9') ? c - '0' : ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') ? (c | 0x20) - 'a' + 10 : 99;
+        if (v >= base)
+            break;
+    }
+    return pos;
+}
+
+/* Check-only scanf subset for the star-ified formats built by vrecv: returns
+   the input length at the trailing %n, -1 if the format is not (yet) matched
+   or FAST_UNSUPPORTED. dead is set when the input already diverged, so no
+   further input can make the line match. */
+static int fast_match(const char* f, const char* in, int len, bool* dead)
+{
+    int pos = 0, count = -1;
+
+    *dead = false;
+    while (*f) {
+        if (isspace((unsigned char)*f)) {
+            while (isspace((unsigned char)*f))
+                f++;
+            while (pos < len && isspace((unsigned char)in[pos]))
+                pos++;
+            continue;
+        }
+        if (*f != '%' || f[1] == '%') {
+            if (*f == '%') {
+                f++;
+                while (pos < len && isspace((unsigned char)in[pos]))
+                    pos++;
+            }
+            if (pos == len)
+                return -1;
+            if (in[pos] != *f) {
+                *dead = true;
+                return -1;
+            }
+            pos++;
+            f++;
+            continue;
+        }
+
+        f++;
+        bool suppress = (*f == '*');
+        if (suppress)
+            f++;
+        int width = 0;
+        while (*f >= '0' && *f <= '9')
+            width = width * 10 + (*f++ - '0');
+        while (*f && strchr("hlLjztq", *f))
+            f++;
+        char conv = *f++;
+
+        if (conv == 'n') {
+            if (!suppress)
+                count = pos;
+            continue;
+        }
+        if (conv != 'c' && conv != '[') {
+            while (pos < len && isspace((unsigned char)in[pos]))
+                pos++;
+        }
+        if (width == 0)
+            width = (conv == 'c') ? 1 : INT_MAX;
+        int lim = (len - pos < width) ? len : pos + width;
+        int start = pos;
+
+        switch (conv) {
+        case 'd':
+        case 'u':
+        case 'i':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'p': {
+            int base = (conv == 'x' || conv == 'X' || conv == 'p') ? 16 : (conv == 'o') ? 8 : 10;
+            if (pos < lim && (in[pos] == '+' || in[pos] == '-'))
+                pos++;
+            bool prefix = false;
+            if ((conv == 'i' || base == 16) && pos + 1 < lim && in[pos] == '0' && (in[pos + 1] | 0x20) == 'x') {
+                base = 16;
+                pos += 2;
+                prefix = true;
+            } else if (conv == 'i' && pos < lim && in[pos] == '0') {
+                base = 8;
+            }
+            start = pos;
+            pos = scan_digits(in, pos, lim, base);
+            // glibc takes a bare "0x" as zero once more input shows up
+            if (pos == start && prefix) {
+                if (pos == len)
+                    return -1;
+                start = pos - 2;
+            }
+            break;
+        }
+        case 'f':
+        case 'e':
+        case 'g':
+        case 'E':
+        case 'G':
+        case 'a': {
+            if (pos < lim && (in[pos] == '+' || in[pos] == '-'))
+                pos++;
+            start = pos;
+            if (pos + 1 < lim && in[pos] == '0' && (in[pos + 1] | 0x20) == 'x')
+                return FAST_UNSUPPORTED;
+            pos = scan_digits(in, pos, lim, 10);
+            if (pos < lim && in[pos] == '.')
+                pos = scan_digits(in, pos + 1, lim, 10);
+            if (pos == start || (pos == start + 1 && in[start] == '.')) {
+                pos = start;
+            } else if (pos < lim && (in[pos] | 0x20) == 'e') {
+                // Like glibc, a dangling exponent mark and sign are consumed
+                int e = pos + 1;
+                if (e < lim && (in[e] == '+' || in[e] == '-'))
+                    e++;
+                pos = scan_digits(in, e, lim, 10);
+            }
+            break;
+        }
+        case 's':
+            while (pos < lim && !isspace((unsigned char)in[pos]))
+                pos++;
+            break;
+        case 'c':
+            // Like glibc, a short %Nc at the end of input still matches
+            pos = lim;
+            break;
+        case '[': {
+            bool neg = (*f == '^');
+            if (neg)
+                f++;
+            const char* set = f;
+            if (*f == ']')
+                f++;
+            while (*f && *f != ']')
+                f++;
+            if (!*f)
+                return FAST_UNSUPPORTED;
+            const char* set_end = f++;
+            for (; pos < lim; pos++) {
+                bool hit = false;
+                for (const char* k = set; k < set_end; k++) {
+                    if (k[1] == '-' && k + 2 < set_end) {
+                        hit = (in[pos] >= k[0] && in[pos] <= k[2]);
+                        k += 2;
+                    } else {
+                        hit = (in[pos] == *k);
+                    }
+                    if (hit)
+                        break;
+                }
+                if (hit == neg)
+                    break;
+            }
+            break;
+        }
+        default:
+            return FAST_UNSUPPORTED;
+        }
+
+        // Nothing converted: wait for more input, or give up on a real char
+        if (pos == start) {
+            if (pos < len)
+                *dead = true;
+            return -1;
+        }
+    }
+    return count;
+}
+
+// True when no input ending in whitespace can match all of fmt: its last
+// directive is a conversion or a literal, neither of which takes trailing
+// whitespace, unlike %c, %[ and whitespace in the format
+static bool tail_rejects_space(const char* fmt)
+{
+    bool rejects = false;
+
+    while (*fmt) {
+        if (fmt[0] == '%' && fmt[1] == '%') {
+            rejects = true;
+            fmt += 2;
+        } else if (*fmt == '%') {
+            fmt++;
+            while (*fmt == '*' || isdigit((unsigned char)*fmt) || strchr("hlLqjzt", *fmt))
+                fmt++;
+            if (*fmt == '[') {
+                fmt++;
+                if (*fmt == '^')
+                    fmt++;
+                if (*fmt == ']')
+                    fmt++;
+                while (*fmt && *fmt != ']')
+                    fmt++;
+                rejects = false;
+            } else if (*fmt && *fmt != 'n') {
+                rejects = (*fmt != 'c');
+            }
+            if (*fmt)
+                fmt++;
+        } else {
+            rejects = !isspace((unsigned char)*fmt);
+            fmt++;
+        }
+    }
+    return rejects;
+}
+
+static int line_match(ATParser *at, const char* fmt, const char* line, int len, bool* dead)
+{
+    int count = -1;
+
+    *dead = false;
+    switch (at->_matcher) {
+    case AT_MATCHER_FAST:
+        count = fast_match(fmt, line, len, dead);
+        if (count != FAST_UNSUPPORTED)
+            return count;
+        *dead = false;
+        count = -1;
+        sscanf(line, fmt, &count);
+        return count;
+
+    case AT_MATCHER_SHADOW: {
+        uint64_t t0 = at_now_ns(at);
+        sscanf(line, fmt, &count);
+        uint64_t t1 = at_now_ns(at);
+        int fast = fast_match(fmt, line, len, dead);
+        uint64_t t2 = at_now_ns(at);
+
+        // The legacy engine stays in charge
+        *dead = false;
+        at->stats.shadow_checks++;
+        at->stats.sscanf_ns += t1 - t0;
+        at->stats.fast_ns += t2 - t1;
+        if (fast == FAST_UNSUPPORTED) {
+            at->stats.shadow_unsupported++;
+        } else if (fast != count) {
+            at->stats.shadow_divergences++;
+            snprintf(at->stats.last_divergence, sizeof(at->stats.last_divergence), "%.31s|%.31s", fmt, line);
+            debug_if(at->_dbg_on, "AT(Shadow) sscanf:%d fast:%d\r\n", count, fast);
+        }
+        return count;
+    }
+
+    default:
+        sscanf(line, fmt, &count);
+        return count;
+    }
+}
+
+static inline bool garbage_byte(int c)
+{
+    return (c < 0x20 && c != CR && c != LF && c != '\t') || c == 0x7f;
+}
+
+// Binary or overlong line, limit is the caller's buffer space
+static bool line_garbage(ATParser *at, int c, int len, int limit, int* binary)
+{
+    if (garbage_byte(c) && at->_garbage_binary && ++*binary >= at->_garbage_binary)
+        return true;
+    if (at->_garbage_line && at->_garbage_line < limit)
+        limit = at->_garbage_line;
+    return len >= limit;
+}
+
+// Drop the rest of a garbage line of len bytes ending in c, false on timeout
+static bool discard_line(ATParser *at, int c, int len)
+{
+    char delim = at->_input_delimiter[at->_input_delim_size - 1];
+
+    at->stats.garbage_lines++;
+    at->stats.garbage_bytes += len;
+    debug_if(at->_dbg_on, "AT(Garbage) %d\r\n", len);
+    while ((char)c != delim) {
+        if (at->ops->skip) {
+            int n = at->ops->skip(delim);
+            at->stats.garbage_bytes += n;
+            at->stats.rx_bytes += n;
+        }
+        c = at_get(at, at->character_timeout);
+        if (c < 0)
+            return false;
+        at->stats.garbage_bytes++;
+    }
+    return true;
+}
+
+// Handler for a line start of len bytes, own handlers first, then shared chains
+static struct oob* oob_find(ATParser *at, const char* line, int len)
+{
+    for (struct oob* oob = at->_oobs; oob; oob = oob->next) {
+        if ((unsigned)len == oob->len && memcmp(oob->prefix, line, len) == 0)
+            return oob;
+    }
+    for (int k = 0; k < at->_nshared; k++) {
+        for (const struct oob* oob = at->_shared_oobs[k]; oob; oob = oob->next) {
+            if ((unsigned)len == oob->len && memcmp(oob->prefix, line, len) == 0)
+                return (struct oob*)oob;
+        }
+    }
+    return NULL;
+}
+
+static void oob_dispatch(ATParser *at, struct oob* oob)
+{
+    AT_TRACE(oob, at, oob->prefix, oob->len);
+    stats_oob(at, oob->prefix);
+    if (oob->cb) {
+        void* arg_saved = at->_oob_arg;
+        bool timed_saved = at->_txn_timed;
+        at->_oob_arg = oob->arg;
+        // The handler's reads are oob time of the transaction, not phases of it
+        at->_txn_timed = false;
+        oob->cb(at);
+        at->_txn_timed = timed_saved;
+        at->_oob_arg = arg_saved;
+        // The handler may have driven another parser
+        _current = at;
+    }
+}
+
 bool ATCmdParser_vrecv(ATParser *at, const char* response, va_list args)
 {
+    _current = at;
+    if (!breaker_allow(at)) {
+        txn_end(at, false);
+        return false;
+    }
     char _in_prev = 0;
     bool _aborted;
+    bool _restarted = false;
+    uint64_t start = at_now_ns(at);
+    bool timed = at->_txn_timed;
 restart:
     _aborted = false;
+    if (_restarted) {
+        AT_TRACE(restart, at);
+        at->stats.restarts++;
+        if (timed)
+            at->_txn.restarts++;
+    }
+    _restarted = true;
     // Iterate through each line in the expected response
     while (response[0]) {
         // Since response is const, we need to copy it into our buffer to
@@ -78,6 +625,10 @@ restart:
                 at->_buffer[offset++] = '%';
                 at->_buffer[offset++] = '*';
                 i++;
+            } else if (response[i] == '%' && response[i + 1] == '%') {
+                // A literal '%' must not star its second half
+                at->_buffer[offset++] = response[i++];
+                at->_buffer[offset++] = response[i++];
             } else {
             	at->_buffer[offset++] = response[i++];
                 // Find linebreaks, taking care not to be fooled if they're in a %[^\n] conversion specification
@@ -103,16 +654,43 @@ restart:
         //
         // We keep trying the match until we succeed or some other error
         // derails us.
-        int j = 0, dummy = 0;
+        int j = 0, dummy = 0, binary = 0;
         int dummy_pos[20];
 
+        // Leading literal chars of the line must match exactly, so a line
+        // that diverges there is skipped without rescanning every byte
+        int lit = 0;
+        bool skip_line = false;
+        while (at->_buffer[lit] && at->_buffer[lit] != '%' && !isspace((unsigned char)at->_buffer[lit]))
+            lit++;
+        // Nor is a line rescanned for each whitespace byte it cannot end in
+        bool space_waits = !whole_line_wanted && tail_rejects_space(at->_buffer);
+
         while (true) {
             // Receive next character
-            int c = at->ops->get(at->character_timeout);
+            int c = at_get(at, at->character_timeout);
             if (c < 0) {
+            timeout:
                 debug_if(at->_dbg_on, "AT(Timeout)\n");
+                AT_TRACE(timeout, at, at->character_timeout);
+                breaker_timeout(at);
+                txn_end(at, false);
                 return false;
             }
+            if (timed)
+                txn_got(at);
+
+            // A dummy char may take one more byte
+            if (line_garbage(at, c, j + 1, AT_BUFFER_SIZE - offset - 2, &binary)) {
+                if (!discard_line(at, c, j + 1))
+                    goto timeout;
+                j = 0;
+                dummy = 0;
+                binary = 0;
+                skip_line = false;
+                _in_prev = '\n';
+                continue;
+            }
 
             /* Possible not existed string may cause %n function failed:
 			example: "cmd:%*s\r\n%n" not match "cmd:\r\n", %n will not 
@@ -126,34 +704,43 @@ restart:
 
             at->_buffer[offset + j++] = c;
             at->_buffer[offset + j] = 0;
+            if (j <= lit && at->_buffer[offset + j - 1] != at->_buffer[j - 1])
+                skip_line = true;
 
-            struct oob* oob = at->_oobs;
             // Check for oob data
-            for (; oob; oob = (struct oob*)oob->next) {
-                if ((unsigned)j == oob->len && memcmp(oob->prefix, at->_buffer + offset, oob->len) == 0) {
-                    debug_if(at->_dbg_on, "AT! %s\n", oob->prefix);
-                    if(oob->cb)
-                    	oob->cb(at);
-
-                    if (_aborted) {
-                        debug_if(at->_dbg_on, "AT(Aborted)\n");
-                        return false;
-                    }
-                    // oob may have corrupted non-reentrant buffer,
-                    // so we need to set it up again
-                    goto restart;
+            struct oob* oob = oob_find(at, at->_buffer + offset, j);
+            if (oob) {
+                debug_if(at->_dbg_on, "AT! %s\n", oob->prefix);
+                uint64_t t0 = timed ? at_now_ns(at) : 0;
+                oob_dispatch(at, oob);
+                if (timed)
+                    at->_txn.oob_ns += at_now_ns(at) - t0;
+
+                if (_aborted) {
+                    debug_if(at->_dbg_on, "AT(Aborted)\n");
+                    txn_end(at, false);
+                    return false;
                 }
+                // oob may have corrupted non-reentrant buffer,
+                // so we need to set it up again
+                goto restart;
             }
 
             // Check for match
             int count = -1;
-            if (whole_line_wanted && (char)c != '\n') {
+            if (skip_line || (whole_line_wanted && (char)c != '\n') || (space_waits && isspace(c))) {
                 // Don't attempt scanning until we get delimiter if they included it in format
                 // This allows recv("Foo: %s\n") to work, and not match with just the first character of a string
                 // (scanf does not itself match whitespace in its format string, so \n is not significant to it)
             } else {
             	char *dp = at->_buffer + offset;
-                sscanf(dp, at->_buffer, &count);
+                bool dead;
+                uint64_t t0 = timed ? at_now_ns(at) : 0;
+                count = line_match(at, at->_buffer, dp, j, &dead);
+                if (timed)
+                    at->_txn.match_ns += at_now_ns(at) - t0;
+                if (dead)
+                    skip_line = true;
                 debug_if(at->_dbg_on, "need chars:%d,actual chars:%d\r\n", j, count);
             }
 
@@ -167,6 +754,10 @@ restart:
                 }
 
                 debug_if(at->_dbg_on, "AT= %s\n", at->_buffer + offset);
+                AT_TRACE(match, at, response, j);
+                breaker_alive(at);
+                at->stats.lines++;
+                observe_line(at, at->_buffer + offset, j);
                 // Reuse the front end of the buffer
                 memcpy(at->_buffer, response, i);
                 at->_buffer[i] = 0;
@@ -178,44 +769,223 @@ restart:
                 break;
             }
 
-            // Clear the buffer when we hit a newline or ran out of space
-            // running out of space usually means we ran into binary data
-            if ((char)c == '\n' || j + 1 >= AT_BUFFER_SIZE - offset) {
+            // Clear the buffer when we hit a newline
+            if ((char)c == '\n') {
                 debug_if(at->_dbg_on, "AT< %s", at->_buffer + offset);
+                AT_TRACE(line, at, at->_buffer + offset, j);
+                AT_TRACE(nomatch, at, response, j);
+                breaker_alive(at);
+                at->stats.lines++;
+                observe_line(at, at->_buffer + offset, j);
                 j = 0;
                 dummy = 0;
+                binary = 0;
+                skip_line = false;
             }
         }
     }
 
+    stats_latency(at, at_now_ns(at) - start);
+    txn_end(at, true);
+    return true;
+}
+
+static bool send_buffer(ATParser *at)
+{
+    int i = 0;
+    for (; at->_buffer[i]; i++) {
+        if (at->ops->put(at->_buffer[i]) < 0) {
+            AT_TRACE(send__end, at, i, 0);
+            txn_end(at, false);
+            return false;
+        }
+    }
+
+    // Finish with newline
+    for (size_t k = 0; at->_output_delimiter[k]; k++) {
+        if (at->ops->put(at->_output_delimiter[k]) < 0) {
+            AT_TRACE(send__end, at, i, 0);
+            txn_end(at, false);
+            return false;
+        }
+    }
+
+    at->stats.tx_bytes += i + at->_output_delim_size;
+    if (at->_txn_timed) {
+        at->_txn_sent = at_now_ns(at);
+        at->_txn.tx_ns = at->_txn_sent - at->_txn.start_ns - at->_txn.oob_ns;
+    }
+    debug_if(at->_dbg_on, "AT> %s\n", at->_buffer);
+    AT_TRACE(send__end, at, i, 1);
+    observe_sent(at, at->_buffer);
     return true;
 }
 
 // Command parsing with line handling
 bool ATCmdParser_vsend(ATParser *at, const char* command, va_list args)
 {
+    _current = at;
+    // A rejected command is still a transaction, failed at once
+    txn_begin(at);
+    if (!breaker_allow(at)) {
+        txn_end(at, false);
+        return false;
+    }
+    AT_TRACE(send__start, at, command, NULL);
+    uint64_t drain = at->_txn_timed ? at_now_ns(at) : 0;
     while (ATCmdParser_process_oob(at))
         ;
+    if (at->_txn_timed)
+        at->_txn.oob_ns += at_now_ns(at) - drain;
     // Create and send command
     if (vsprintf(at->_buffer, command, args) < 0) {
+        txn_end(at, false);
         return false;
     }
 
-    for (int i = 0; at->_buffer[i]; i++) {
-        if (at->ops->put(at->_buffer[i]) < 0) {
-            return false;
+    return send_buffer(at);
+}
+
+bool ATCmdParser_template_compile(at_template* tpl, const char* command)
+{
+    const char* lit = command;
+    tpl->count = 0;
+
+    while (true) {
+        const char* p = strchr(lit, '%');
+        int n = p ? p - lit : (int)strlen(lit);
+
+        // "%%" keeps its first '%' in the literal chunk
+        if (p && p[1] == '%')
+            n++;
+        if (n > 0) {
+            if (tpl->count == AT_TEMPLATE_MAX_PARTS)
+                return false;
+            tpl->parts[tpl->count].type = AT_TPL_LIT;
+            tpl->parts[tpl->count].len = n;
+            tpl->parts[tpl->count++].lit = lit;
+        }
+        if (!p)
+            return true;
+        if (p[1] == '%') {
+            lit = p + 2;
+            continue;
         }
-    }
 
-    // Finish with newline
-    for (size_t i = 0; at->_output_delimiter[i]; i++) {
-        if (at->ops->put(at->_output_delimiter[i]) < 0) {
+        at_tpl_type type;
+        switch (p[1]) {
+        case 'd':
+        case 'i': type = AT_TPL_INT; break;
+        case 'u': type = AT_TPL_UINT; break;
+        case 'x': type = AT_TPL_HEX; break;
+        case 'X': type = AT_TPL_HEX_UPPER; break;
+        case 's': type = AT_TPL_STR; break;
+        case 'c': type = AT_TPL_CHAR; break;
+        default: return false;
+        }
+        if (tpl->count == AT_TEMPLATE_MAX_PARTS)
             return false;
+        tpl->parts[tpl->count].type = type;
+        tpl->parts[tpl->count].len = 0;
+        tpl->parts[tpl->count++].lit = NULL;
+        lit = p + 2;
+    }
+}
+
+static int format_uint(char* out, unsigned v, unsigned base, const char* digits)
+{
+    char tmp[12];
+    int n = 0;
+
+    do {
+        tmp[n++] = digits[v % base];
+        v /= base;
+    } while (v);
+
+    for (int i = 0; i < n; i++)
+        out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+bool ATCmdParser_send_template(ATParser *at, const at_template* tpl, ...)
+{
+    _current = at;
+    va_list args;
+    int pos = 0;
+    bool res = true;
+
+    txn_begin(at);
+    if (!breaker_allow(at)) {
+        txn_end(at, false);
+        return false;
+    }
+    AT_TRACE(send__start, at, NULL, tpl);
+
+    uint64_t drain = at->_txn_timed ? at_now_ns(at) : 0;
+    while (ATCmdParser_process_oob(at))
+        ;
+    if (at->_txn_timed)
+        at->_txn.oob_ns += at_now_ns(at) - drain;
+
+    va_start(args, tpl);
+    for (int k = 0; k < tpl->count && res; k++) {
+        const at_tpl_part* part = &tpl->parts[k];
+        // Largest fixed size slot is a sign and ten digits
+        if (part->type != AT_TPL_LIT && part->type != AT_TPL_STR && pos + 11 >= AT_BUFFER_SIZE) {
+            res = false;
+            break;
+        }
+
+        switch (part->type) {
+        case AT_TPL_LIT:
+            if (pos + part->len >= AT_BUFFER_SIZE) {
+                res = false;
+                break;
+            }
+            memcpy(at->_buffer + pos, part->lit, part->len);
+            pos += part->len;
+            break;
+        case AT_TPL_INT: {
+            int v = va_arg(args, int);
+            unsigned u = v;
+            if (v < 0) {
+                at->_buffer[pos++] = '-';
+                u = 0u - u;
+            }
+            pos += format_uint(at->_buffer + pos, u, 10, "0123456789");
+            break;
+        }
+        case AT_TPL_UINT:
+            pos += format_uint(at->_buffer + pos, va_arg(args, unsigned), 10, "0123456789");
+            break;
+        case AT_TPL_HEX:
+            pos += format_uint(at->_buffer + pos, va_arg(args, unsigned), 16, "0123456789abcdef");
+            break;
+        case AT_TPL_HEX_UPPER:
+            pos += format_uint(at->_buffer + pos, va_arg(args, unsigned), 16, "0123456789ABCDEF");
+            break;
+        case AT_TPL_CHAR:
+            at->_buffer[pos++] = (char)va_arg(args, int);
+            break;
+        case AT_TPL_STR: {
+            const char* str = va_arg(args, const char*);
+            while (*str && pos + 1 < AT_BUFFER_SIZE)
+                at->_buffer[pos++] = *str++;
+            if (*str)
+                res = false;
+            break;
+        }
         }
     }
+    va_end(args);
 
-    debug_if(at->_dbg_on, "AT> %s\n", at->_buffer);
-    return true;
+    if (!res) {
+        debug_if(at->_dbg_on, "AT(Overflow)\n");
+        txn_end(at, false);
+        return false;
+    }
+    at->_buffer[pos] = 0;
+    return send_buffer(at);
 }
 
 bool ATCmdParser_recv(ATParser *at, const char* response, ...)
@@ -239,6 +1009,7 @@ bool ATCmdParser_send(ATParser *at, const char* command, ...)
 // read/write handling with timeouts
 int ATCmdParser_write(ATParser *at, const char* data, int size)
 {
+    _current = at;
     int i = 0;
     for (; i < size; i++) {
         if (at->ops->put(data[i]) < 0) {
@@ -246,14 +1017,16 @@ int ATCmdParser_write(ATParser *at, const char* data, int size)
         }
         //mx_delay(1);
     }
+    at->stats.tx_bytes += i;
     return i;
 }
 
 int ATCmdParser_read(ATParser *at, char* data, int size)
 {
+    _current = at;
     int i = 0;
     for (; i < size; i++) {
-        int c = at->ops->get(at->character_timeout);
+        int c = at_get(at, at->character_timeout);
         if (c < 0) {
             return -1;
         }
@@ -267,83 +1040,332 @@ void ATCmdParser_debug(ATParser *at, bool on)
 	at->_dbg_on = on;
 }
 
-void ATCmdParser_add_oob(ATParser *at, const char* prefix, oob_callback cb)
+void ATCmdParser_add_oob_static(ATParser *at, struct oob* oob, const char* prefix, oob_callback cb)
+{
+    ATCmdParser_add_oob_arg(at, oob, prefix, cb, NULL);
+}
+
+void ATCmdParser_add_oob_arg(ATParser *at, struct oob* oob, const char* prefix, oob_callback cb, void* arg)
 {
-    struct oob* oob = malloc(sizeof(struct oob));
     oob->len = strlen(prefix);
     oob->prefix = prefix;
     oob->cb = cb;
+    oob->arg = arg;
     oob->next = at->_oobs;
     at->_oobs = oob;
 }
 
+bool ATCmdParser_add_shared_oobs(ATParser *at, const struct oob* chain)
+{
+    for (int k = 0; k < at->_nshared; k++) {
+        if (at->_shared_oobs[k] == chain)
+            return true;
+    }
+    if (at->_nshared == AT_MAX_SHARED_OOBS)
+        return false;
+    at->_shared_oobs[at->_nshared++] = chain;
+    return true;
+}
 
-bool ATCmdParser_process_oob(ATParser *at)
+void* ATCmdParser_oob_arg(ATParser *at)
+{
+    return at->_oob_arg;
+}
+
+void ATCmdParser_add_observer(ATParser *at, struct at_observer* obs)
 {
+    obs->next = at->_observers;
+    at->_observers = obs;
+}
+
+void ATCmdParser_remove_observer(ATParser *at, struct at_observer* obs)
+{
+    for (struct at_observer** p = &at->_observers; *p; p = &(*p)->next) {
+        if (*p == obs) {
+            *p = obs->next;
+            return;
+        }
+    }
+}
+
+#ifndef ATCMDPARSER_NO_MALLOC
+void ATCmdParser_add_oob(ATParser *at, const char* prefix, oob_callback cb)
+{
+    struct oob* oob = malloc(sizeof(struct oob));
+    ATCmdParser_add_oob_static(at, oob, prefix, cb);
+}
+#endif
+
+
+// Where process_lines frames, limit is the longest line it holds
+static inline char* frame_buf(ATParser *at, int* limit)
+{
+    if (at->_frame) {
+        *limit = at->_frame_size - 1;
+        return at->_frame;
+    }
+    *limit = AT_BUFFER_SIZE - 1;
+    return at->_buffer;
+}
+
+// Read lines until one is out-of-band, or only the next line when one_line
+static bool process_lines(ATParser *at, bool one_line)
+{
+    _current = at;
     if (!at->ops->readable()) {
         return false;
     }
 
-    int i = 0;
+    int i = 0, binary = 0, limit;
+    char* buf = frame_buf(at, &limit);
     while (true) {
         // Receive next character
-        int c = at->ops->get(at->character_timeout);
+        int c = at_get(at, at->character_timeout);
         if (c < 0) {
+            AT_TRACE(timeout, at, at->character_timeout);
             return false;
         }
-        at->_buffer[i++] = c;
-        at->_buffer[i] = 0;
+        buf[i++] = c;
+        buf[i] = 0;
+
+        if (line_garbage(at, c, i, limit, &binary)) {
+            if (!discard_line(at, c, i))
+                return false;
+            i = 0;
+            binary = 0;
+            continue;
+        }
 
         // Check for oob data
-        struct oob* oob = at->_oobs;
-        while (oob) {
-            if (i == (int)oob->len && memcmp(oob->prefix, at->_buffer, oob->len) == 0) {
-                debug_if(at->_dbg_on, "AT! %s\r\n", oob->prefix);
-                if(oob->cb)
-                	oob->cb(at);
-                return true;
-            }
-            oob = oob->next;
+        struct oob* oob = oob_find(at, buf, i);
+        if (oob) {
+            debug_if(at->_dbg_on, "AT! %s\r\n", oob->prefix);
+            oob_dispatch(at, oob);
+            return true;
         }
 
-        // Clear the buffer when we hit a newline or ran out of space
-        // running out of space usually means we ran into binary data
-        if (i + 1 >= AT_BUFFER_SIZE || strcmp(&at->_buffer[i - at->_input_delim_size], at->_input_delimiter) == 0) {
+        // Clear the buffer when we hit a newline
+        if (i >= at->_input_delim_size
+                && strcmp(&buf[i - at->_input_delim_size], at->_input_delimiter) == 0) {
 
-            debug_if(at->_dbg_on, "AT< %s, %d\r\n", at->_buffer, i);
+            debug_if(at->_dbg_on, "AT< %s, %d\r\n", buf, i);
+            AT_TRACE(line, at, buf, i);
+            at->stats.lines++;
+            observe_line(at, buf, i);
 
             if(at->unprocessed_data)
-            	at->unprocessed_data(at->_buffer,i);
+            	at->unprocessed_data(buf,i);
+            if(at->_line_cb)
+            	at->_line_cb(at, at->_line_arg, buf, i);
+            if (one_line)
+                return true;
 
+            // The callback may have handed over the frame
+            buf = frame_buf(at, &limit);
             i = 0;
+            binary = 0;
         }
     }
 }
 
+bool ATCmdParser_process_oob(ATParser *at)
+{
+    return process_lines(at, false);
+}
+
+bool ATCmdParser_process_line(ATParser *at)
+{
+    return process_lines(at, true);
+}
+
+static bool deadline_passed(ATParser *at)
+{
+    return at->_has_deadline && (int32_t)(at_now_ms(at) - at->_deadline) >= 0;
+}
+
+int ATCmdParser_getline(ATParser *at, char* line, int size)
+{
+    _current = at;
+    int i = 0, binary = 0;
+    char* buf = at->_buffer;
+    bool timed = at->_txn_timed;
+    while (true) {
+        // Receive next character
+        int c = at_get(at, at->character_timeout);
+        if (c < 0) {
+        timeout:
+            debug_if(at->_dbg_on, "AT(Timeout)\n");
+            AT_TRACE(timeout, at, at->character_timeout);
+            breaker_timeout(at);
+            txn_end(at, false);
+            return -1;
+        }
+        if (timed)
+            txn_got(at);
+        buf[i++] = c;
+        buf[i] = 0;
+
+        if (line_garbage(at, c, i, AT_BUFFER_SIZE - 1, &binary)) {
+            if (!discard_line(at, c, i))
+                goto timeout;
+            i = 0;
+            binary = 0;
+            continue;
+        }
+
+        // Check for oob data, the handler consumes the rest of the packet
+        struct oob* oob = oob_find(at, buf, i);
+        if (oob) {
+            debug_if(at->_dbg_on, "AT! %s\r\n", oob->prefix);
+            uint64_t t0 = timed ? at_now_ns(at) : 0;
+            oob_dispatch(at, oob);
+            if (timed)
+                at->_txn.oob_ns += at_now_ns(at) - t0;
+            i = 0;
+            binary = 0;
+            if (deadline_passed(at))
+                goto expired;
+            continue;
+        }
+
+        if (i < at->_input_delim_size
+                || strcmp(&buf[i - at->_input_delim_size], at->_input_delimiter) != 0) {
+            continue;
+        }
+
+        // Strip delimiter and skip the empty lines around responses
+        while (i > 0 && (buf[i - 1] == CR || buf[i - 1] == LF))
+            buf[--i] = 0;
+        binary = 0;
+        if (i == 0) {
+            if (deadline_passed(at))
+                goto expired;
+            continue;
+        }
+
+        debug_if(at->_dbg_on, "AT< %s\r\n", buf);
+        AT_TRACE(line, at, buf, i);
+        breaker_alive(at);
+        at->stats.lines++;
+        observe_line(at, buf, i);
+        if (i > size - 1)
+            i = size - 1;
+        memcpy(line, buf, i);
+        line[i] = 0;
+        txn_end(at, true);
+        return i;
+    }
+
+expired:
+    // The modem is talking, only the caller ran out of time
+    debug_if(at->_dbg_on, "AT(Deadline)\n");
+    AT_TRACE(timeout, at, at->character_timeout);
+    at->stats.timeouts++;
+    txn_end(at, false);
+    return -1;
+}
+
+static bool sync_ready_urc(const char* line)
+{
+    return strcmp(line, "RDY") == 0 || strncmp(line, "+CFUN:", 6) == 0 || strncmp(line, "+CPIN:", 6) == 0;
+}
+
+bool ATCmdParser_sync(ATParser *at, int timeout, int* elapsed)
+{
+    char line[16];
+    int timeout_saved = at->character_timeout;
+    int threshold_saved = at->_breaker.threshold;
+    int interval = AT_SYNC_MIN_INTERVAL;
+    uint32_t start, now;
+    bool clocked = ATCmdParser_clock_ms(at, &start);
+    int waited = 0;
+    bool ready = false;
+
+    // Probe timeouts are expected here, keep them away from the breaker
+    at->_breaker.threshold = 0;
+
+    // Drop whatever the modem printed while booting
+    while (at->ops->readable() && at_get(at, 0) >= 0)
+        ;
+
+    while (!ready && waited < timeout) {
+        if (ATCmdParser_write(at, "AT", 2) < 0
+                || ATCmdParser_write(at, at->_output_delimiter, at->_output_delim_size) < 0)
+            break;
+
+        at->character_timeout = interval;
+        while (true) {
+            int n = ATCmdParser_getline(at, line, sizeof(line));
+            if (n < 0) {
+                if (!clocked)
+                    waited += interval;
+                if (interval < AT_SYNC_MAX_INTERVAL)
+                    interval *= 2;
+                break;
+            }
+            if (strcmp(line, "OK") == 0) {
+                ready = true;
+                break;
+            }
+            if (sync_ready_urc(line)) {
+                debug_if(at->_dbg_on, "AT(Ready) %s\r\n", line);
+                interval = AT_SYNC_MIN_INTERVAL;
+                break;
+            }
+            // Echo and chatter must not keep the probe alive past the
+            // timeout, without a clock each line is charged an interval
+            if (clocked) {
+                ATCmdParser_clock_ms(at, &now);
+                waited = now - start;
+            } else {
+                waited += interval;
+            }
+            if (waited >= timeout)
+                break;
+        }
+
+        if (clocked) {
+            ATCmdParser_clock_ms(at, &now);
+            waited = now - start;
+        }
+    }
+
+    at->character_timeout = timeout_saved;
+    at->_breaker.threshold = threshold_saved;
+    if (ready) {
+        at->_breaker.failures = 0;
+        at->_breaker.state = AT_BREAKER_CLOSED;
+        at->_breaker.backoff_ms = at->_breaker.open_ms;
+    }
+    if (elapsed)
+        *elapsed = waited;
+    debug_if(at->_dbg_on, "AT(Sync) %s after %d ms\r\n", ready ? "ready" : "timeout", waited);
+    return ready;
+}
+
 int ATCmdParser_analyse_args(ATParser *at, char args[], char* arg_list[], int list_size)
 {
-    char _in_prev = 0;
     int arg_num = 1;
-    size_t len = strlen(args);
+    char* w = args;
 
     arg_list[0] = args;
 
-    for (int i = 0; i <= len; i++) {
-        debug_if(at->_dbg_on, "check %c, %d\r\n", args[i], len);
-        if (args[i] == ',') {
+    // Single pass, unescaped text is compacted in place behind the read pointer
+    for (const char* r = args; *r; r++) {
+        if (r[0] == '\\' && r[1] == ',') {
+            *w++ = ',';
+            r++;
+        } else if (*r == ',') {
             debug_if(at->_dbg_on, "find ,\r\n");
-            if (_in_prev == '\\') {
-                args[i - i] = ',';
-                memcpy(&args[i], &args[i + 1], len - (i + 1));
-            } else {
-                args[i] = 0;
-                arg_list[arg_num++] = &args[i + 1];
-                if (arg_num > list_size)
-                    break;
-            }
+            if (arg_num >= list_size)
+                break;
+            *w++ = 0;
+            arg_list[arg_num++] = w;
+        } else {
+            *w++ = *r;
         }
-        _in_prev = args[i];
     }
+    *w = 0;
     return arg_num;
 }
 
@@ -357,9 +1379,111 @@ void ATCmdParser_set_unprocessed_cb(ATParser *at, void (*cb)(const char *,int ))
 	at->unprocessed_data = cb;
 }
 
-ATParser *ATCmdParser_init(serial_ops *hal, const char* output_delimiter, const char* input_delimiter, int timeout, bool debug)
+void ATCmdParser_set_line_cb(ATParser *at, void (*cb)(void *, void *, const char *, int), void* arg)
+{
+	at->_line_arg = arg;
+	at->_line_cb = cb;
+}
+
+void ATCmdParser_set_matcher(ATParser *at, at_matcher matcher)
+{
+	at->_matcher = matcher;
+}
+
+void ATCmdParser_get_stats(ATParser *at, ATParserStats* stats)
+{
+	memcpy(stats, &at->stats, sizeof(ATParserStats));
+}
+
+void ATCmdParser_reset_stats(ATParser *at)
+{
+	memset(&at->stats, 0, sizeof(ATParserStats));
+}
+
+bool ATCmdParser_set_breaker(ATParser *at, int threshold, int open_ms, int max_open_ms)
+{
+#ifndef AT_SYSTEM_CLOCK
+	// Without a clock an open breaker would never let a probe through
+	if (!at->ops->tick && threshold > 0)
+		threshold = 0;
+#endif
+	at->_breaker.threshold = threshold;
+	at->_breaker.open_ms = open_ms;
+	at->_breaker.max_open_ms = max_open_ms > open_ms ? max_open_ms : open_ms;
+	at->_breaker.backoff_ms = open_ms;
+	at->_breaker.failures = 0;
+	at->_breaker.state = AT_BREAKER_CLOSED;
+	return threshold > 0;
+}
+
+bool ATCmdParser_clock_ms(ATParser *at, uint32_t* ms)
+{
+	*ms = at_now_ms(at);
+#ifdef AT_SYSTEM_CLOCK
+	return true;
+#else
+	return at->ops->tick != NULL;
+#endif
+}
+
+bool ATCmdParser_set_deadline(ATParser *at, int ms)
+{
+	uint32_t now;
+
+	at->_has_deadline = ms > 0 && ATCmdParser_clock_ms(at, &now);
+	at->_deadline = at->_has_deadline ? now + ms : 0;
+	return at->_has_deadline;
+}
+
+at_breaker_state ATCmdParser_breaker_state(ATParser *at)
+{
+	return at->_breaker.state;
+}
+
+void ATCmdParser_set_garbage_filter(ATParser *at, int max_line, int max_binary)
+{
+	at->_garbage_line = max_line;
+	at->_garbage_binary = max_binary;
+}
+
+void ATCmdParser_set_frame_buffer(ATParser *at, char* buf, int size)
 {
-	ATParser *at = calloc(1, sizeof(ATParser));
+	at->_frame = buf;
+	at->_frame_size = size;
+}
+
+void ATCmdParser_set_txn_sampling(ATParser *at, uint32_t every)
+{
+	at->_txn_every = every;
+	at->_txn_seq = 0;
+}
+
+bool ATCmdParser_last_txn(ATParser *at, at_txn_timing* txn)
+{
+	if (!at->_txn.start_ns)
+		return false;
+	memcpy(txn, &at->_txn, sizeof(at_txn_timing));
+	return true;
+}
+
+void ATCmdParser_set_priv(ATParser *at, void* priv)
+{
+	at->priv = priv;
+}
+
+void* ATCmdParser_priv(ATParser *at)
+{
+	return at->priv;
+}
+
+ATParser *ATCmdParser_current(void)
+{
+	return _current;
+}
+
+ATParser *ATCmdParser_init_static(ATParser *at, serial_ops *hal, const char* output_delimiter, const char* input_delimiter, int timeout, bool debug)
+{
+	memset(at, 0, sizeof(ATParser));
 	at->_dbg_on = debug;
 
 	at->_output_delimiter = output_delimiter;
@@ -370,7 +1494,18 @@ ATParser *ATCmdParser_init(serial_ops *hal, const char* output_delimiter, const
 
     at->ops = hal;
 
+    _current = at;
     at->ops->init(timeout);
 
     return at;
 }
+
+#ifndef ATCMDPARSER_NO_MALLOC
+ATParser *ATCmdParser_init(serial_ops *hal, const char* output_delimiter, const char* input_delimiter, int timeout, bool debug)
+{
+	ATParser *at = malloc(sizeof(ATParser));
+	if (!at)
+		return NULL;
+	return ATCmdParser_init_static(at, hal, output_delimiter, input_delimiter, timeout, debug);
+}
+#endif
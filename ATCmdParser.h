@@ -37,6 +37,17 @@ extern "C" {
 /** \addtogroup emhost */
 /** @{*/
 #define AT_BUFFER_SIZE	(2048)
+/* recv latency histogram, upper bucket bounds in ms, the last bucket is unbounded */
+#define AT_STATS_LATENCY_BOUNDS_MS	{ 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000 }
+#define AT_STATS_LATENCY_BUCKETS	(12)
+/* Out-of-band prefixes counted separately, later ones go to oob_other */
+#define AT_STATS_MAX_OOB	(8)
+/* Suggested non-text bytes that mark a line as binary garbage, see #ATCmdParser_set_garbage_filter */
+#define AT_GARBAGE_BINARY	(4)
+
+/* Define ATCMDPARSER_NO_MALLOC to drop the heap based ATCmdParser_init and
+   ATCmdParser_add_oob, all storage then comes from the caller through the
+   _static variants and steady-state send/recv/process_oob never allocate */
 /** \addtogroup AT_parser */
 /** @{*/
 
@@ -44,6 +55,12 @@ extern "C" {
  *                                 Constants
  ******************************************************************************/
 
+#define AT_TEMPLATE_MAX_PARTS	(16)
+#define AT_GET_AGAIN			(-2)	/* get: no byte without blocking the caller, not a timeout */
+#define AT_SYNC_MIN_INTERVAL	(20)	/* ms between the first "AT" probes */
+#define AT_SYNC_MAX_INTERVAL	(640)
+#define AT_MAX_SHARED_OOBS		(4)		/* handler chains a parser can share, see #ATCmdParser_add_shared_oobs */
+
 /******************************************************************************
  *                               Type Definitions
  ******************************************************************************/
@@ -61,28 +78,175 @@ struct oob {
     const char* prefix;
     oob_callback cb;
     void* next;
+    void* arg;			/* see #ATCmdParser_oob_arg */
+};
+
+/**
+ * Traffic observer link node, sees the commands sent and the response lines
+ * read without taking them, see #ATCmdParser_add_observer
+ */
+struct at_observer {
+    void (*sent)(void* arg, const char* cmd);				/* command without delimiter, may be NULL */
+    void (*line)(void* arg, const char* line, int len);	/* line without delimiter, not terminated at len, may be NULL */
+    void* arg;
+    struct at_observer* next;
 };
 
+/**
+ * Precompiled send template part, literal chunk or typed argument slot
+ */
+typedef enum {
+    AT_TPL_LIT = 0,
+    AT_TPL_INT,		/* %d, %i */
+    AT_TPL_UINT,	/* %u */
+    AT_TPL_HEX,		/* %x */
+    AT_TPL_HEX_UPPER,	/* %X */
+    AT_TPL_STR,		/* %s */
+    AT_TPL_CHAR,	/* %c */
+} at_tpl_type;
+
+typedef struct {
+    at_tpl_type type;
+    int len;
+    const char* lit;
+} at_tpl_part;
+
+/**
+ * Send format split into parts once by #ATCmdParser_template_compile,
+ * literal parts point into the format string which must stay valid
+ */
+typedef struct {
+    int count;
+    at_tpl_part parts[AT_TEMPLATE_MAX_PARTS];
+} at_template;
+
+/**
+ * Response matching engine used by #ATCmdParser_recv
+ */
+typedef enum {
+    AT_MATCHER_SSCANF = 0,	/* libc sscanf, default */
+    AT_MATCHER_FAST,		/* built-in scanf subset, falls back to sscanf for unsupported formats */
+    AT_MATCHER_SHADOW,		/* sscanf decides, the fast engine runs alongside and is compared */
+} at_matcher;
+
+/**
+ * Circuit breaker state, see #ATCmdParser_set_breaker
+ */
+typedef enum {
+    AT_BREAKER_CLOSED = 0,	/* commands pass */
+    AT_BREAKER_OPEN,		/* commands fail at once until the open period ends */
+    AT_BREAKER_HALF_OPEN,	/* commands pass as probes, a line closes, a timeout reopens */
+} at_breaker_state;
+
+typedef struct {
+    int threshold;			/* consecutive timeouts that open the breaker, 0: disabled */
+    int open_ms;			/* first open period */
+    int max_open_ms;		/* open period doubles on every failed probe up to this */
+    int backoff_ms;			/* current open period */
+    int failures;			/* consecutive timeouts */
+    at_breaker_state state;
+    uint32_t opened_at;		/* ms, see serial_ops tick */
+} at_breaker;
+
+/**
+ * Where the time of one command went, see #ATCmdParser_set_txn_sampling.
+ * A transaction runs from a send to the next one and covers every recv and
+ * getline between; a command refused by the breaker is a failed transaction
+ */
+typedef struct {
+    uint64_t start_ns;		/* send began, system clock */
+    uint64_t tx_ns;			/* formatting and writing the command */
+    uint64_t wait_ns;		/* command written to the first byte received by recv or getline */
+    uint64_t rx_ns;			/* the rest: receiving and parsing the response */
+    uint64_t match_ns;		/* response matcher */
+    uint64_t oob_ns;		/* out-of-band handlers run by send, recv and getline */
+    uint64_t total_ns;		/* send began to the last recv or getline returned */
+    uint32_t restarts;		/* recv matches restarted after a handler */
+    bool ok;				/* last recv matched, last getline got a line */
+} at_txn_timing;
+
+/**
+ * Parser statistics, see #ATCmdParser_get_stats
+ */
+typedef struct {
+    uint32_t shadow_checks;			/* partial lines matched by both engines */
+    uint32_t shadow_divergences;	/* checks where the engines disagreed */
+    uint32_t shadow_unsupported;	/* checks the fast engine could not handle */
+    uint64_t sscanf_ns;				/* time spent in each engine in shadow mode */
+    uint64_t fast_ns;
+    char last_divergence[64];		/* "<format>|<input>" of the last divergence */
+    uint32_t timeouts;				/* recv and getline timeouts */
+    uint32_t breaker_opens;			/* closed or half-open to open */
+    uint32_t breaker_probes;		/* open to half-open */
+    uint32_t breaker_closes;		/* half-open to closed */
+    uint32_t breaker_rejects;		/* commands failed without touching the port */
+    uint32_t garbage_lines;			/* binary or overlong lines discarded */
+    uint64_t garbage_bytes;			/* bytes of those lines */
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint32_t lines;					/* complete lines received outside handlers' reads */
+    uint32_t restarts;				/* recv matches restarted after an out-of-band packet */
+    uint32_t recv_latency[AT_STATS_LATENCY_BUCKETS];	/* successful recv calls by duration */
+    uint64_t recv_latency_ns;		/* sum of those durations */
+    struct {
+        const char* prefix;
+        uint32_t hits;
+    } oob_hits[AT_STATS_MAX_OOB];	/* dispatches per handler prefix */
+    uint32_t oob_other;
+    uint32_t txns;					/* timed transactions, summed when the next one starts */
+    uint64_t txn_tx_ns;
+    uint64_t txn_wait_ns;
+    uint64_t txn_rx_ns;
+    uint64_t txn_match_ns;
+    uint64_t txn_oob_ns;
+} ATParserStats;
+
 /******************************************************************************
  *                             Function Declarations
  ******************************************************************************/
 typedef struct{
-	int (*get)(int);
+	int (*get)(int);		/* byte, -1 on timeout or #AT_GET_AGAIN */
 	int (*put)(char);
 	int (*readable)();
 	int (*init)(int);
+	void (*delay)(int);		/* optional: sleep for given milliseconds */
+	uint32_t (*tick)(void);	/* optional: monotonic time in milliseconds */
+	int (*skip)(char);		/* optional: drop buffered input up to, not including, the given char, return bytes dropped */
 }serial_ops;
 
 typedef struct{
 	serial_ops *ops;
 	struct oob* _oobs;
+	const struct oob* _shared_oobs[AT_MAX_SHARED_OOBS];	/* read only, checked after _oobs */
+	int _nshared;
 	void (*unprocessed_data)(const char *,int );
+	void (*_line_cb)(void *, void *, const char *, int);
+	void* _line_arg;
 	int character_timeout;
 	bool _dbg_on;
 	const char* _output_delimiter;
 	int _output_delim_size;
 	const char* _input_delimiter;
 	int _input_delim_size;
+	void* priv;
+	void* _oob_arg;
+	struct at_observer* _observers;
+	at_matcher _matcher;
+	at_breaker _breaker;
+	bool _again;					/* last get could not wait, see #AT_GET_AGAIN */
+	bool _has_deadline;				/* see #ATCmdParser_set_deadline */
+	uint32_t _deadline;				/* ms */
+	int _garbage_line;
+	int _garbage_binary;
+	uint32_t _txn_every;
+	uint32_t _txn_seq;
+	bool _txn_timed;
+	bool _txn_got;
+	uint64_t _txn_sent;
+	at_txn_timing _txn;
+	char* _frame;					/* lines of process_oob, NULL: _buffer */
+	int _frame_size;
+	ATParserStats stats;
 	char _buffer[AT_BUFFER_SIZE];
 }ATParser;
 
@@ -105,6 +269,30 @@ void ATCmdParser_debug(ATParser *at, bool on);
  */
 ATParser *ATCmdParser_init(serial_ops *hal, const char* output_delimiter, const char* input_delimiter, int timeout, bool debug);
 
+/**
+ * @brief 		AT command parser initialize in caller storage, see #ATCmdParser_init
+ *
+ * @param[out] 	at: parser storage, e.g. a static or arena object
+ *
+ * @return 		at
+ */
+ATParser *ATCmdParser_init_static(ATParser *at, serial_ops *hal, const char* output_delimiter, const char* input_delimiter, int timeout, bool debug);
+
+/**
+ * @brief 			Wait for the modem to answer after power-on, "AT" is sent at
+ *                  exponentially growing intervals starting from #AT_SYNC_MIN_INTERVAL,
+ *                  "RDY", "+CFUN:" and "+CPIN:" restart probing at the shortest
+ *                  interval, other input is flushed
+ * @note    		Lines consumed by a registered out-of-band handler are not seen
+ *
+ * @param[in] 		timeout: give up after this many milliseconds
+ * @param[out] 		elapsed: time to ready in milliseconds by the tick or system clock,
+ *                  without either the probe intervals plus one per unrelated line, may be NULL
+ *
+ * @return 			true: modem answered "OK", false: Timeout
+ */
+bool ATCmdParser_sync(ATParser *at, int timeout, int* elapsed);
+
 /**
  * @brief 			Recv AT command respont, and parse AT parameters to variables
  * 
@@ -123,6 +311,38 @@ bool ATCmdParser_recv(ATParser *at, const char* response, ...);
  */
 bool ATCmdParser_send(ATParser *at, const char* command, ...);
 
+/**
+ * @brief 			Split a send format into literal chunks and typed slots,
+ *                  supported conversions: %d %i %u %x %X %s %c %%
+ *
+ * @param[out] 		tpl: template to fill
+ * @param[in] 		command: AT command format, without delimiter
+ *
+ * @return 			true: Success, false: unsupported conversion or too many parts
+ */
+bool ATCmdParser_template_compile(at_template* tpl, const char* command);
+
+/**
+ * @brief 			Send AT command from a precompiled template, arguments are
+ *                  formatted directly into the TX buffer without printf
+ *
+ * @param[in] 		tpl: template from #ATCmdParser_template_compile
+ *
+ * @return 			true: Success, false: Serial port send error or buffer overflow
+ */
+bool ATCmdParser_send_template(ATParser *at, const at_template* tpl, ...);
+
+/**
+ * @brief 			Receive the next non-empty line, out-of-band packets are dispatched
+ *                  to their handlers while waiting
+ *
+ * @param[out] 		line: Buffer to store the line, delimiter stripped
+ * @param[in] 		size: Buffer size, longer lines are truncated
+ *
+ * @return 			length of the line, -1: Timeout
+ */
+int ATCmdParser_getline(ATParser *at, char* line, int size);
+
 /**
  * @brief 			Add a handler to an incomming out-of-band packet type, 
  *                  example: oob format: "\r\n+<TYPE>：[para-1,para-2,para-2,...,para-n]\r\n", 
@@ -135,6 +355,63 @@ bool ATCmdParser_send(ATParser *at, const char* command, ...);
  */
 void ATCmdParser_add_oob(ATParser *at, const char* prefix, oob_callback cb);
 
+/**
+ * @brief 			Add an out-of-band handler using a caller provided list node,
+ *                  see #ATCmdParser_add_oob
+ *
+ * @param[in] 		oob: list node, must stay valid while the parser is used
+ *
+ * @return 			none
+ */
+void ATCmdParser_add_oob_static(ATParser *at, struct oob* oob, const char* prefix, oob_callback cb);
+
+/**
+ * @brief 			Like #ATCmdParser_add_oob_static with an argument the handler
+ *                  reads through #ATCmdParser_oob_arg, lets one handler serve
+ *                  many parsers or state objects
+ *
+ * @param[in] 		arg: handler argument
+ *
+ * @return 			none
+ */
+void ATCmdParser_add_oob_arg(ATParser *at, struct oob* oob, const char* prefix, oob_callback cb, void* arg);
+
+/**
+ * @brief 			Check a read-only handler chain after the parser's own handlers.
+ *                  The chain is never written, so many parsers may share it
+ *
+ * @param[in] 		chain: first node, linked through next
+ *
+ * @return 			true: Success or already added, false: #AT_MAX_SHARED_OOBS reached
+ */
+bool ATCmdParser_add_shared_oobs(ATParser *at, const struct oob* chain);
+
+/**
+ * @brief 			Argument of the out-of-band handler running on this parser
+ *
+ * @return 			arg given to #ATCmdParser_add_oob_arg, NULL outside handlers
+ */
+void* ATCmdParser_oob_arg(ATParser *at);
+
+/**
+ * @brief 			Show the commands sent and the lines read by recv, getline,
+ *                  process_oob and process_line to an observer. The lines stay
+ *                  with their reader; those an out-of-band handler takes over
+ *                  after its prefix are not shown
+ *
+ * @param[in] 		obs: list node, must stay valid until removed
+ *
+ * @return 			none
+ */
+void ATCmdParser_add_observer(ATParser *at, struct at_observer* obs);
+
+/**
+ * @brief 			Remove an observer added with #ATCmdParser_add_observer
+ *
+ * @return 			none
+ */
+void ATCmdParser_remove_observer(ATParser *at, struct at_observer* obs);
+
 /**
  * @brief 			Read raw data from AT command serial port
  * 
@@ -171,6 +448,14 @@ void ATCmdParser_set_timeout(ATParser *at, int timeout);
  */
 bool ATCmdParser_process_oob(ATParser *at);
 
+/**
+ * @brief 			Like #ATCmdParser_process_oob but return after one line,
+ *                  out-of-band or not, so a caller can share the port in turns
+ *
+ * @return 			true: proccessed a line, false: no complete line to process
+ */
+bool ATCmdParser_process_line(ATParser *at);
+
 /**
  * @brief 			Analyse string parameters form AT command respond, 
  *                  Respond format: "[\r\n][+CMD:][para-1,para-2,para-3,......]<\r\n><STATUS><\r\n>"
@@ -188,6 +473,157 @@ int ATCmdParser_analyse_args(ATParser *at, char args[], char* arg_list[], int li
 
 
 void ATCmdParser_set_unprocessed_cb(ATParser *at, void (*cb)(const char *,int ));
+
+/**
+ * @brief 			Like #ATCmdParser_set_unprocessed_cb, but the handler also gets
+ *                  the parser and a user argument: cb(at, arg, line, len)
+ *
+ * @param[in] 		cb: handler, NULL to remove
+ * @param[in] 		arg: user argument passed to the handler
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_line_cb(ATParser *at, void (*cb)(void *, void *, const char *, int), void* arg);
+
+/**
+ * @brief 			Select the response matching engine, #AT_MATCHER_SHADOW runs
+ *                  both engines on the same input and records divergences and
+ *                  per-engine time in the statistics
+ *
+ * @param[in] 		matcher: engine
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_matcher(ATParser *at, at_matcher matcher);
+
+/**
+ * @brief 			Copy the parser statistics, counters are updated by the thread
+ *                  driving the parser and read without locking. Called from
+ *                  another thread the copy is not a consistent snapshot: each
+ *                  32-bit counter is current to within a few events, while on
+ *                  32-bit targets a 64-bit counter (the byte counts and _ns sums)
+ *                  may be read torn between its halves. Call it from the
+ *                  driving thread for exact values
+ *
+ * @param[out] 		stats: statistics snapshot
+ *
+ * @return 			none
+ */
+void ATCmdParser_get_stats(ATParser *at, ATParserStats* stats);
+
+void ATCmdParser_reset_stats(ATParser *at);
+
+/**
+ * @brief 			Enable the per-parser circuit breaker: after threshold consecutive
+ *                  timeouts send and recv fail at once for open_ms, then commands
+ *                  pass as probes, the first received line closes the breaker and
+ *                  a timeout opens it again for twice as long, up to max_open_ms.
+ *                  #ATCmdParser_sync, read, write and process_oob are never blocked,
+ *                  a successful sync closes the breaker
+ * @note    		Uses serial_ops tick when provided, the system clock otherwise
+ *                  on unix; other targets without a tick hook cannot time the
+ *                  open period, the breaker then stays disabled
+ *
+ * @param[in] 		threshold: consecutive timeouts to open, 0 disables the breaker
+ * @param[in] 		open_ms: first open period
+ * @param[in] 		max_open_ms: longest open period
+ *
+ * @return 			true: breaker enabled, false: disabled or no clock
+ */
+bool ATCmdParser_set_breaker(ATParser *at, int threshold, int open_ms, int max_open_ms);
+
+at_breaker_state ATCmdParser_breaker_state(ATParser *at);
+
+/**
+ * @brief 			Read the parser clock: serial_ops tick when provided, the
+ *                  system clock otherwise on unix
+ *
+ * @param[out] 		ms: milliseconds, wrapping
+ *
+ * @return 			true: Success, false: no clock on this target
+ */
+bool ATCmdParser_clock_ms(ATParser *at, uint32_t* ms);
+
+/**
+ * @brief 			Configure when a line is dropped as garbage instead of being
+ *                  matched: once it holds max_binary non-text bytes (crash dumps,
+ *                  misrouted data) or grows past max_line. The rest of the line is
+ *                  then skipped up to the next input delimiter, through serial_ops
+ *                  skip when the port provides it, and counted in the stats
+ *
+ * @param[in] 		max_line: longest line kept, 0 or too large: the parser buffer
+ * @param[in] 		max_binary: non-text bytes that mark a line, e.g. #AT_GARBAGE_BINARY,
+ *                  0 disables the check (default)
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_garbage_filter(ATParser *at, int max_line, int max_binary);
+
+/**
+ * @brief 			Frame the lines read by process_oob and process_line in buf
+ *                  instead of the parser buffer, so a line callback takes the line
+ *                  without a copy. Lines that do not fit are discarded as garbage;
+ *                  getline and recv keep framing in the parser buffer
+ *
+ * @param[in] 		buf: frame, NULL for the parser buffer
+ * @param[in] 		size: frame size including the terminator
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_frame_buffer(ATParser *at, char* buf, int size);
+
+/**
+ * @brief 			Make getline give up once the parser clock passes now + ms,
+ *                  checked after every line including out-of-band ones, so a
+ *                  stream of URCs cannot hold it past the caller's budget.
+ *                  Lines arriving do not count towards the breaker's timeouts
+ *
+ * @param[in] 		ms: budget from now, 0 clears the deadline
+ *
+ * @return 			true: deadline set, false: cleared or no clock
+ */
+bool ATCmdParser_set_deadline(ATParser *at, int ms);
+
+/**
+ * @brief 			Time the phases of every n-th transaction, splitting modem
+ *                  latency from parser overhead. Untimed transactions skip the phase
+ *                  clock reads; recv still reads the clock on entry and on a match
+ *                  for the recv_latency histogram
+ *
+ * @param[in] 		every: 1 times all, 0 disables timing (default)
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_txn_sampling(ATParser *at, uint32_t every);
+
+/**
+ * @brief 			Phases of the last timed transaction, still growing while
+ *                  its recv calls run
+ *
+ * @return 			true: Success, false: Nothing timed yet
+ */
+bool ATCmdParser_last_txn(ATParser *at, at_txn_timing* txn);
+
+/**
+ * @brief 			Attach user data to the parser, e.g. the port a shared
+ *                  serial_ops implementation should drive
+ *
+ * @param[in] 		priv: user data
+ *
+ * @return 			none
+ */
+void ATCmdParser_set_priv(ATParser *at, void* priv);
+
+void* ATCmdParser_priv(ATParser *at);
+
+/**
+ * @brief 			Parser whose serial port the calling thread is driving, lets
+ *                  one serial_ops implementation serve many parsers:
+ *                  ATCmdParser_priv(ATCmdParser_current()) inside get/put
+ *
+ * @return 			parser, NULL if none
+ */
+ATParser *ATCmdParser_current(void);
 /** @}*/
 /** @}*/
 
@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdRegistry.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include "ATCmdRegistry.h"
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static inline bool registry_open(at_registry* reg)
+{
+    return !atomic_load_explicit(&reg->frozen, memory_order_relaxed);
+}
+
+void ATCmdRegistry_init(at_registry* reg)
+{
+    memset(reg, 0, sizeof(at_registry));
+    atomic_init(&reg->frozen, false);
+}
+
+bool ATCmdRegistry_add_oob(at_registry* reg, const char* prefix, oob_callback cb, void* arg)
+{
+    if (!registry_open(reg) || reg->noobs == AT_REGISTRY_MAX_OOBS)
+        return false;
+
+    struct oob* oob = &reg->oobs[reg->noobs++];
+    oob->len = strlen(prefix);
+    oob->prefix = prefix;
+    oob->cb = cb;
+    oob->arg = arg;
+    oob->next = NULL;
+    return true;
+}
+
+int ATCmdRegistry_add_template(at_registry* reg, const char* name, const char* command)
+{
+    if (!registry_open(reg) || reg->ntemplates == AT_REGISTRY_MAX_TEMPLATES)
+        return -1;
+    if (!ATCmdParser_template_compile(&reg->templates[reg->ntemplates].tpl, command))
+        return -1;
+    reg->templates[reg->ntemplates].name = name;
+    return reg->ntemplates++;
+}
+
+int ATCmdRegistry_add_seq(at_registry* reg, const char* name, const at_seq_step* steps)
+{
+    if (!registry_open(reg) || reg->nseqs == AT_REGISTRY_MAX_SEQS)
+        return -1;
+    reg->seqs[reg->nseqs].name = name;
+    reg->seqs[reg->nseqs].steps = steps;
+    return reg->nseqs++;
+}
+
+void ATCmdRegistry_freeze(at_registry* reg)
+{
+    if (!registry_open(reg))
+        return;
+    for (int i = 0; i + 1 < reg->noobs; i++)
+        reg->oobs[i].next = &reg->oobs[i + 1];
+    atomic_store_explicit(&reg->frozen, true, memory_order_release);
+}
+
+bool ATCmdRegistry_attach(ATParser *at, const at_registry* reg)
+{
+    if (!atomic_load_explicit(&reg->frozen, memory_order_acquire))
+        return false;
+    if (!reg->noobs)
+        return true;
+
+    // The parser only follows the chain, the shared nodes are never written
+    return ATCmdParser_add_shared_oobs(at, &reg->oobs[0]);
+}
+
+int ATCmdRegistry_find_template(const at_registry* reg, const char* name)
+{
+    for (int i = 0; i < reg->ntemplates; i++) {
+        if (reg->templates[i].name && strcmp(reg->templates[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int ATCmdRegistry_find_seq(const at_registry* reg, const char* name)
+{
+    for (int i = 0; i < reg->nseqs; i++) {
+        if (reg->seqs[i].name && strcmp(reg->seqs[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
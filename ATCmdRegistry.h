@@ -0,0 +1,146 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdRegistry.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_REGISTRY_H_
+#define _AT_CMD_REGISTRY_H_
+
+#include "ATCmdAtomic.h"
+#include "ATCmdParser.h"
+#include "ATCmdSeq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_REGISTRY_MAX_OOBS		(32)
+#define AT_REGISTRY_MAX_TEMPLATES	(32)
+#define AT_REGISTRY_MAX_SEQS		(16)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Patterns shared by any number of parsers, built once and frozen.
+ * Handles are indexes into the tables and stay valid for the registry's life
+ */
+typedef struct {
+    at_atomic_bool frozen;
+    int noobs;
+    int ntemplates;
+    int nseqs;
+    struct oob oobs[AT_REGISTRY_MAX_OOBS];     /* one dispatch chain, read only once frozen */
+    struct {
+        const char* name;
+        at_template tpl;
+    } templates[AT_REGISTRY_MAX_TEMPLATES];
+    struct {
+        const char* name;
+        const at_seq_step* steps;
+    } seqs[AT_REGISTRY_MAX_SEQS];
+} at_registry;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+void ATCmdRegistry_init(at_registry* reg);
+
+/**
+ * @brief 			Add an out-of-band handler to the shared table, handlers are
+ *                  checked in registration order
+ *
+ * @param[in] 		arg: shared by all parsers, the device is the handler's parser
+ *                  or its #ATCmdParser_priv
+ *
+ * @return 			true: Success, false: Frozen or #AT_REGISTRY_MAX_OOBS reached
+ */
+bool ATCmdRegistry_add_oob(at_registry* reg, const char* prefix, oob_callback cb, void* arg);
+
+/**
+ * @brief 			Compile a send format once for all parsers
+ *
+ * @param[in] 		name: lookup key for #ATCmdRegistry_find_template, may be NULL
+ * @param[in] 		command: format, see #ATCmdParser_template_compile
+ *
+ * @return 			handle, -1: Frozen, full or unsupported format
+ */
+int ATCmdRegistry_add_template(at_registry* reg, const char* name, const char* command);
+
+/**
+ * @brief 			Register a command sequence table under a name
+ *
+ * @return 			handle, -1: Frozen or full
+ */
+int ATCmdRegistry_add_seq(at_registry* reg, const char* name, const at_seq_step* steps);
+
+/**
+ * @brief 			Make the registry read only, call before the first attach;
+ *                  afterwards any thread may use it without locking
+ *
+ * @return 			none
+ */
+void ATCmdRegistry_freeze(at_registry* reg);
+
+/**
+ * @brief 			Hand the shared handlers to a parser: its own handlers, added
+ *                  before or after, are still checked first and no per-parser
+ *                  copies are made
+ *
+ * @return 			true: Success, false: Registry not frozen or the parser
+ *                  already shares #AT_MAX_SHARED_OOBS chains
+ */
+bool ATCmdRegistry_attach(ATParser *at, const at_registry* reg);
+
+int ATCmdRegistry_find_template(const at_registry* reg, const char* name);
+
+int ATCmdRegistry_find_seq(const at_registry* reg, const char* name);
+
+/**
+ * @brief 			Compiled template of a handle, for #ATCmdParser_send_template
+ */
+static inline const at_template* ATCmdRegistry_template(const at_registry* reg, int handle)
+{
+    return &reg->templates[handle].tpl;
+}
+
+/**
+ * @brief 			Sequence table of a handle, for #ATCmdSeq_run
+ */
+static inline const at_seq_step* ATCmdRegistry_seq(const at_registry* reg, int handle)
+{
+    return reg->seqs[handle].steps;
+}
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_REGISTRY_H_
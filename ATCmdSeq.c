@@ -0,0 +1,206 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdSeq.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include "ATCmdSeq.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_SEQ_LINE_SIZE	(128)
+#define AT_SEQ_PENDING		(-5)	/* internal: the step is still waiting */
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+const at_seq_branch ATCmdSeq_ok[] = {
+    { "OK", AT_SEQ_NEXT },
+    { "ERROR", AT_SEQ_RETRY },
+    { "+CME ERROR", AT_SEQ_RETRY },
+    { NULL, 0 },
+};
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+// Jump targets are the special values or a step of the table, its end included
+static bool seq_target_ok(const at_seq* seq, int next)
+{
+    return (next >= AT_SEQ_RETRY && next <= AT_SEQ_NEXT) || (next >= 0 && next <= seq->count);
+}
+
+static int seq_match(const at_seq_step* step, const char* line)
+{
+    for (const at_seq_branch* b = step->branches; b && b->prefix; b++) {
+        if (strncmp(line, b->prefix, strlen(b->prefix)) == 0)
+            return b->next;
+    }
+    return AT_SEQ_PENDING;
+}
+
+static int seq_expect(ATParser *at, at_seq* seq, const at_seq_step* step, bool block)
+{
+    char line[AT_SEQ_LINE_SIZE];
+    int timeout = at->character_timeout;
+    int budget = step->timeout > 0 ? step->timeout : timeout;
+    uint32_t now;
+
+    // Without a clock only a blocking read can time the step
+    if (!ATCmdParser_clock_ms(at, &now))
+        block = true;
+    if (!seq->waiting) {
+        seq->waiting = true;
+        seq->since = now;
+    }
+
+    int next = AT_SEQ_PENDING;
+    while (next == AT_SEQ_PENDING) {
+        int left = budget - (int)(now - seq->since);
+        if (left <= 0) {
+            next = AT_SEQ_RETRY;
+            break;
+        }
+        if (!block && !at->ops->readable())
+            break;
+        // The deadline also holds while getline dispatches out-of-band lines
+        at->character_timeout = left;
+        ATCmdParser_set_deadline(at, left);
+        if (ATCmdParser_getline(at, line, sizeof(line)) < 0)
+            next = AT_SEQ_RETRY;
+        else
+            next = seq_match(step, line);
+        ATCmdParser_clock_ms(at, &now);
+    }
+
+    ATCmdParser_set_deadline(at, 0);
+    at->character_timeout = timeout;
+    return next;
+}
+
+static int seq_delay(ATParser *at, at_seq* seq, const at_seq_step* step, bool block)
+{
+    uint32_t now;
+
+    if (!block && ATCmdParser_clock_ms(at, &now)) {
+        if (!seq->waiting) {
+            seq->waiting = true;
+            seq->since = now;
+        }
+        return (int)(now - seq->since) >= step->timeout ? AT_SEQ_NEXT : AT_SEQ_PENDING;
+    }
+    // Skipping the wait would run the next step too early
+    if (!at->ops->delay)
+        return step->on_fail;
+    at->ops->delay(step->timeout);
+    return AT_SEQ_NEXT;
+}
+
+// Run steps until one has to wait, which only happens when not blocking
+static at_seq_status seq_advance(ATParser *at, at_seq* seq, bool block)
+{
+    int next;
+
+    while (true) {
+        const at_seq_step* step = &seq->steps[seq->pc];
+
+        switch (step->op) {
+        case AT_SEQ_OP_END:
+            return AT_SEQ_SUCCEEDED;
+
+        case AT_SEQ_OP_SEND:
+            next = ATCmdParser_send(at, "%s", step->cmd) ? AT_SEQ_NEXT : step->on_fail;
+            break;
+
+        case AT_SEQ_OP_DELAY:
+            next = seq_delay(at, seq, step, block);
+            break;
+
+        case AT_SEQ_OP_EXPECT:
+            next = seq_expect(at, seq, step, block);
+            if (next == AT_SEQ_RETRY) {
+                if (seq->tries < step->retries) {
+                    seq->tries++;
+                    next = step->retry;
+                } else {
+                    seq->tries = 0;
+                    next = step->on_fail;
+                }
+            } else if (next != AT_SEQ_PENDING) {
+                seq->tries = 0;
+            }
+            break;
+
+        default:
+            next = AT_SEQ_FAIL;
+            break;
+        }
+
+        if (next == AT_SEQ_PENDING)
+            return AT_SEQ_RUNNING;
+        seq->waiting = false;
+        if (next == AT_SEQ_DONE)
+            return AT_SEQ_SUCCEEDED;
+        if (next == AT_SEQ_FAIL || next == AT_SEQ_RETRY)
+            return AT_SEQ_FAILED;
+        seq->pc = (next == AT_SEQ_NEXT) ? seq->pc + 1 : next;
+    }
+}
+
+bool ATCmdSeq_start(at_seq* seq, const at_seq_step* steps)
+{
+    memset(seq, 0, sizeof(at_seq));
+    seq->steps = steps;
+    while (steps[seq->count].op != AT_SEQ_OP_END)
+        seq->count++;
+
+    for (int k = 0; k < seq->count; k++) {
+        const at_seq_step* step = &steps[k];
+        bool ok = seq_target_ok(seq, step->on_fail);
+
+        if (step->op == AT_SEQ_OP_EXPECT) {
+            ok = ok && seq_target_ok(seq, step->retry);
+            for (const at_seq_branch* b = step->branches; ok && b && b->prefix; b++)
+                ok = seq_target_ok(seq, b->next);
+        }
+        if (!ok) {
+            seq->pc = k;
+            return false;
+        }
+    }
+    return true;
+}
+
+at_seq_status ATCmdSeq_step(ATParser *at, at_seq* seq)
+{
+    return seq_advance(at, seq, false);
+}
+
+bool ATCmdSeq_run(ATParser *at, const at_seq_step* steps, int* last_step)
+{
+    at_seq seq;
+    bool ok = ATCmdSeq_start(&seq, steps) && seq_advance(at, &seq, true) == AT_SEQ_SUCCEEDED;
+
+    if (last_step)
+        *last_step = seq.pc;
+    return ok;
+}
@@ -0,0 +1,155 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdSeq.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_SEQ_H_
+#define _AT_CMD_SEQ_H_
+
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+/* Special jump targets, any other value is an index in the step table */
+#define AT_SEQ_NEXT		(-1)	/* continue with the following step */
+#define AT_SEQ_DONE		(-2)	/* stop, sequence succeeded */
+#define AT_SEQ_FAIL		(-3)	/* stop, sequence failed */
+#define AT_SEQ_RETRY	(-4)	/* handle like a timeout of the current step */
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef enum {
+    AT_SEQ_OP_END = 0,
+    AT_SEQ_OP_SEND,
+    AT_SEQ_OP_EXPECT,
+    AT_SEQ_OP_DELAY,
+} at_seq_op;
+
+/**
+ * One alternative of an expect step, table is terminated by a NULL prefix
+ */
+typedef struct {
+    const char* prefix;
+    int next;
+} at_seq_branch;
+
+/**
+ * Sequence step, build tables with the AT_SEQ_* step macros below
+ */
+typedef struct {
+    at_seq_op op;
+    const char* cmd;                    /* SEND: command line without delimiter */
+    const at_seq_branch* branches;      /* EXPECT: accepted line prefixes */
+    int timeout;                        /* EXPECT: timeout of the whole step, 0 for parser default; DELAY: milliseconds */
+    int retries;                        /* EXPECT: times to jump back to retry on timeout */
+    int retry;                          /* EXPECT: step to jump back to */
+    int on_fail;                        /* target once retries are exhausted, send failed or delay is not supported */
+} at_seq_step;
+
+#define AT_SEQ_SEND(cmd) \
+    { AT_SEQ_OP_SEND, (cmd), NULL, 0, 0, 0, AT_SEQ_FAIL }
+#define AT_SEQ_EXPECT(branches, timeout, retries, retry, on_fail) \
+    { AT_SEQ_OP_EXPECT, NULL, (branches), (timeout), (retries), (retry), (on_fail) }
+#define AT_SEQ_DELAY(ms) \
+    { AT_SEQ_OP_DELAY, NULL, NULL, (ms), 0, 0, AT_SEQ_FAIL }
+#define AT_SEQ_END() \
+    { AT_SEQ_OP_END, NULL, NULL, 0, 0, 0, AT_SEQ_FAIL }
+
+typedef enum {
+    AT_SEQ_RUNNING = 0,     /* waiting for a line or a delay, step again */
+    AT_SEQ_SUCCEEDED,
+    AT_SEQ_FAILED,
+} at_seq_status;
+
+/**
+ * A sequence driven by #ATCmdSeq_step, set up with #ATCmdSeq_start
+ */
+typedef struct {
+    const at_seq_step* steps;
+    int count;              /* steps before AT_SEQ_END */
+    int pc;                 /* current step */
+    int tries;
+    bool waiting;           /* the current step's wait has begun */
+    uint32_t since;         /* ms, the wait began */
+} at_seq;
+
+/**
+ * "OK" continues, "ERROR" and "+CME ERROR" are retried like a timeout
+ */
+extern const at_seq_branch ATCmdSeq_ok[];
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Execute a command sequence table inside the parser, lines not
+ *                  matching any branch are skipped and out-of-band packets are
+ *                  dispatched while waiting. Blocks until the sequence ends,
+ *                  see #ATCmdSeq_step to drive it from an event loop
+ * @note    		The retry counter is shared by the steps between two
+ *                  successful expects
+ *
+ * @param[in] 		steps: step table, terminated by #AT_SEQ_END
+ * @param[out] 		last_step: index of the last executed step, may be NULL
+ *
+ * @return 			true: sequence completed, false: a step failed or a jump
+ *                  target is outside the table
+ */
+bool ATCmdSeq_run(ATParser *at, const at_seq_step* steps, int* last_step);
+
+/**
+ * @brief 			Prepare a sequence for #ATCmdSeq_step, checking every jump
+ *                  target against the table
+ *
+ * @param[in] 		steps: step table, terminated by #AT_SEQ_END
+ *
+ * @return 			true: ready, false: seq->pc is a step jumping outside the table
+ */
+bool ATCmdSeq_start(at_seq* seq, const at_seq_step* steps);
+
+/**
+ * @brief 			Run the sequence as far as it gets without waiting: lines
+ *                  already readable are matched and expired timeouts and delays
+ *                  are taken, then it returns. Call again when the port is
+ *                  readable or a timer fires. Timeouts and delays need the parser
+ *                  clock; without one expects and delays block as in #ATCmdSeq_run
+ *
+ * @return 			#AT_SEQ_RUNNING until the sequence succeeded or failed at seq->pc
+ */
+at_seq_status ATCmdSeq_step(ATParser *at, at_seq* seq);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_SEQ_H_
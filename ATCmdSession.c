@@ -0,0 +1,285 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdSession.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ATCmdSession.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define SESSION_CRC_OFFSET	(offsetof(at_session, saved_at))
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static uint32_t session_crc(const at_session* s)
+{
+    const uint8_t* p = (const uint8_t*)s + SESSION_CRC_OFFSET;
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < sizeof(at_session) - SESSION_CRC_OFFSET; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+at_session *ATCmdSession_open(const char* path)
+{
+    struct stat st;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || (st.st_size != sizeof(at_session)
+            && (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(at_session)) < 0))) {
+        close(fd);
+        return NULL;
+    }
+
+    at_session* s = mmap(NULL, sizeof(at_session), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return s == MAP_FAILED ? NULL : s;
+}
+
+bool ATCmdSession_valid(const at_session* s)
+{
+    return s->magic == AT_SESSION_MAGIC && s->version == AT_SESSION_VERSION
+           && s->size == sizeof(at_session) && s->crc == session_crc(s);
+}
+
+void ATCmdSession_commit(at_session* s)
+{
+    s->magic = AT_SESSION_MAGIC;
+    s->version = AT_SESSION_VERSION;
+    s->size = sizeof(at_session);
+    s->saved_at = (uint32_t)time(NULL);
+    s->crc = session_crc(s);
+    msync(s, sizeof(at_session), MS_ASYNC);
+}
+
+void ATCmdSession_invalidate(at_session* s)
+{
+    s->magic = 0;
+    msync(s, sizeof(at_session), MS_ASYNC);
+}
+
+static uint32_t watch_bit(int id)
+{
+    return id >= 0 && id < 32 ? 1u << id : 0;
+}
+
+static void watch_reset(at_session_watch* w)
+{
+    w->echo = -1;
+    w->verbose = -1;
+    w->cmee = -1;
+    w->baud = 0;
+    w->close_id = -1;
+    w->field = NULL;
+    w->value[0] = 0;
+}
+
+static void watch_query(at_session_watch* w, char* field, int size)
+{
+    w->field = field;
+    w->field_size = size;
+}
+
+// Basic commands like "ATE0V1" up to one extended command, held until answered
+static void watch_sent(void* arg, const char* cmd)
+{
+    at_session_watch* w = arg;
+
+    watch_reset(w);
+    if ((cmd[0] | 0x20) != 'a' || (cmd[1] | 0x20) != 't')
+        return;
+    const char* p = cmd + 2;
+    while (isalpha((unsigned char)*p)) {
+        char c = *p++ | 0x20;
+        int n = atoi(p);
+        while (isdigit((unsigned char)*p))
+            p++;
+        if (c == 'e')
+            w->echo = n != 0;
+        else if (c == 'v')
+            w->verbose = n != 0;
+    }
+
+    if (*p != '+')
+        return;
+    if (sscanf(p, "+CMEE=%d", &w->cmee) == 1 || sscanf(p, "+IPR=%d", &w->baud) == 1
+            || sscanf(p, "+QICLOSE=%d", &w->close_id) == 1)
+        return;
+    if (strcmp(p, "+CGSN") == 0 || strcmp(p, "+GSN") == 0)
+        watch_query(w, w->s->imei, sizeof(w->s->imei));
+    else if (strcmp(p, "+QCCID") == 0 || strcmp(p, "+CCID") == 0 || strcmp(p, "+ICCID") == 0)
+        watch_query(w, w->s->iccid, sizeof(w->s->iccid));
+    else if (strcmp(p, "+CGMM") == 0 || strcmp(p, "+GMM") == 0)
+        watch_query(w, w->s->model, sizeof(w->s->model));
+    else if (strcmp(p, "+CGMR") == 0 || strcmp(p, "+GMR") == 0)
+        watch_query(w, w->s->revision, sizeof(w->s->revision));
+}
+
+// Final result of the watched command: settings take effect on OK only
+static bool watch_result(at_session_watch* w, const char* line)
+{
+    at_session* s = w->s;
+    // Numeric result codes only in ATV0, elsewhere "0" may be an information line
+    bool numeric = !s->verbose;
+    bool ok = strcmp(line, "OK") == 0 || (numeric && strcmp(line, "0") == 0);
+
+    if (!ok && strcmp(line, "ERROR") != 0 && !(numeric && strcmp(line, "4") == 0)
+            && strncmp(line, "+CME ERROR", 10) != 0 && strncmp(line, "+CMS ERROR", 10) != 0)
+        return false;
+    if (ok) {
+        at_session before = *s;
+        if (w->echo >= 0)
+            s->echo = w->echo;
+        if (w->verbose >= 0)
+            s->verbose = w->verbose;
+        if (w->cmee >= 0)
+            s->cmee = w->cmee;
+        if (w->baud > 0)
+            s->baud = w->baud;
+        if (w->close_id >= 0)
+            s->sockets &= ~watch_bit(w->close_id);
+        if (w->field && w->value[0]) {
+            strncpy(w->field, w->value, w->field_size - 1);
+            w->field[w->field_size - 1] = 0;
+        }
+        if (memcmp(&before, s, sizeof(at_session)) != 0)
+            ATCmdSession_commit(s);
+    }
+    watch_reset(w);
+    return true;
+}
+
+// Socket and MQTT reports, they change the session as they arrive
+static bool watch_report(at_session_watch* w, const char* line)
+{
+    at_session* s = w->s;
+    uint32_t sockets = s->sockets, mqtt = s->mqtt;
+    int id, a, b;
+    int n;
+
+    if (sscanf(line, "+QIOPEN: %d,%d", &id, &a) == 2) {
+        if (a == 0)
+            sockets |= watch_bit(id);
+    } else if (sscanf(line, "+QIURC: \"closed\",%d", &id) == 1) {
+        sockets &= ~watch_bit(id);
+    } else if ((n = sscanf(line, "+QMTCONN: %d,%d,%d", &id, &a, &b)) >= 2) {
+        // A connect result has three fields, the state query two, 3 is connected
+        if (n == 3 ? a == 0 && b == 0 : a == 3)
+            mqtt |= watch_bit(id);
+        else
+            mqtt &= ~watch_bit(id);
+    } else if (sscanf(line, "+QMTDISC: %d,%d", &id, &a) == 2 || sscanf(line, "+QMTSTAT: %d,%d", &id, &a) == 2) {
+        mqtt &= ~watch_bit(id);
+    } else {
+        return false;
+    }
+    if (sockets != s->sockets || mqtt != s->mqtt) {
+        s->sockets = sockets;
+        s->mqtt = mqtt;
+        ATCmdSession_commit(s);
+    }
+    return true;
+}
+
+static void watch_line(void* arg, const char* line, int len)
+{
+    at_session_watch* w = arg;
+    char buf[64];
+
+    if (len > (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    memcpy(buf, line, len);
+    buf[len] = 0;
+
+    if (watch_result(w, buf) || watch_report(w, buf))
+        return;
+    // The first information line answers an identity query, echoes are skipped
+    if (!w->field || w->value[0] || ((buf[0] | 0x20) == 'a' && (buf[1] | 0x20) == 't'))
+        return;
+    const char* v = buf;
+    if (buf[0] == '+' && strchr(buf, ':')) {
+        v = strchr(buf, ':') + 1;
+        while (*v == ' ')
+            v++;
+    }
+    strncpy(w->value, v, sizeof(w->value) - 1);
+    w->value[sizeof(w->value) - 1] = 0;
+}
+
+void ATCmdSession_attach(at_session_watch* w, at_session* s, ATParser *at)
+{
+    w->s = s;
+    watch_reset(w);
+    w->obs.sent = watch_sent;
+    w->obs.line = watch_line;
+    w->obs.arg = w;
+    ATCmdParser_add_observer(at, &w->obs);
+}
+
+void ATCmdSession_detach(at_session_watch* w, ATParser *at)
+{
+    ATCmdParser_remove_observer(at, &w->obs);
+}
+
+bool ATCmdSession_probe(ATParser *at, const at_session* s)
+{
+    char line[64];
+    bool echoed = false, imei = false;
+
+    if (!ATCmdSession_valid(s) || !ATCmdParser_send(at, "AT+CGSN"))
+        return false;
+
+    while (ATCmdParser_getline(at, line, sizeof(line)) >= 0) {
+        if (strcmp(line, "AT+CGSN") == 0)
+            echoed = true;
+        else if (strcmp(line, s->imei) == 0)
+            imei = true;
+        // ATV0 answers with numeric result codes
+        else if (strcmp(line, "OK") == 0 || strcmp(line, "0") == 0)
+            return imei && echoed == (s->echo != 0);
+        else if (strcmp(line, "ERROR") == 0 || strcmp(line, "4") == 0 || strncmp(line, "+CME ERROR", 10) == 0)
+            return false;
+    }
+    return false;
+}
+
+void ATCmdSession_close(at_session* s)
+{
+    munmap(s, sizeof(at_session));
+}
@@ -0,0 +1,164 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdSession.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_SESSION_H_
+#define _AT_CMD_SESSION_H_
+
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_SESSION_MAGIC	(0x41545353)	/* "ATSS" */
+#define AT_SESSION_VERSION	(1)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Session snapshot kept in a memory-mapped file, survives restarts of the
+ * process while the modem keeps running
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t crc;               /* over everything after this field */
+    uint32_t saved_at;          /* unix time of the last commit */
+    int32_t baud;               /* negotiated baud rate */
+    uint8_t echo;               /* ATE state */
+    uint8_t verbose;            /* ATV state */
+    uint8_t cmee;               /* AT+CMEE mode */
+    uint8_t reserved;
+    uint32_t sockets;           /* bitmap of open socket ids */
+    uint32_t mqtt;              /* bitmap of connected MQTT client ids */
+    char imei[20];
+    char iccid[24];
+    char model[24];
+    char revision[32];
+} at_session;
+
+/**
+ * Keeps a session current from a parser's traffic, see #ATCmdSession_attach
+ */
+typedef struct {
+    at_session* s;
+    struct at_observer obs;
+    int echo;                   /* set by the command waiting for its result, -1 none */
+    int verbose;
+    int cmee;
+    int32_t baud;               /* 0 none */
+    int close_id;               /* AT+QICLOSE waiting for its result, -1 none */
+    char* field;                /* identity field the running command answers, NULL none */
+    int field_size;
+    char value[32];
+} at_session_watch;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Map the session file, created and zeroed if missing or of the
+ *                  wrong size
+ *
+ * @param[in] 		path: session file
+ *
+ * @return 			mapped session, NULL on error
+ */
+at_session *ATCmdSession_open(const char* path);
+
+/**
+ * @brief 			Check magic, version and checksum of a mapped session
+ *
+ * @return 			true: the snapshot is complete and may be trusted
+ */
+bool ATCmdSession_valid(const at_session* s);
+
+/**
+ * @brief 			Seal the snapshot after updating fields and schedule write-back
+ *
+ * @return 			none
+ */
+void ATCmdSession_commit(at_session* s);
+
+/**
+ * @brief 			Mark the snapshot stale, e.g. before resetting the modem
+ *
+ * @return 			none
+ */
+void ATCmdSession_invalidate(at_session* s);
+
+/**
+ * @brief 			Update and commit the session from what the parser sends and
+ *                  reads, without taking any line from recv or getline callers:
+ *                  ATE, ATV, AT+CMEE and AT+IPR once answered OK, the IMEI, ICCID,
+ *                  model and revision queries, sockets from +QIOPEN, AT+QICLOSE and
+ *                  closed reports, MQTT clients from +QMTCONN, +QMTDISC and +QMTSTAT
+ * @note    		Lines an out-of-band handler takes over are not seen
+ *
+ * @param[out] 		w: watch, must stay valid until #ATCmdSession_detach
+ * @param[in] 		s: mapped session
+ *
+ * @return 			none
+ */
+void ATCmdSession_attach(at_session_watch* w, at_session* s, ATParser *at);
+
+/**
+ * @brief 			Stop updating the session from the parser
+ *
+ * @return 			none
+ */
+void ATCmdSession_detach(at_session_watch* w, ATParser *at);
+
+/**
+ * @brief 			Validate the snapshot against the modem with one "AT+CGSN"
+ *                  round trip: the modem must answer, return the cached IMEI and
+ *                  echo the command only if echo was on (modems reset to echo on).
+ *                  Numeric result codes of ATV0 are accepted
+ *
+ * @return 			true: the modem kept running, bring-up can be skipped
+ */
+bool ATCmdSession_probe(ATParser *at, const at_session* s);
+
+/**
+ * @brief 			Unmap the session
+ *
+ * @return 			none
+ */
+void ATCmdSession_close(at_session* s);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_SESSION_H_
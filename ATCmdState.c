@@ -0,0 +1,282 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdState.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include <ctype.h>
+
+#include "ATCmdState.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define STATE_MAX_ARGS	(12)
+#define STATE_LINE_SIZE	(160)
+#define STATE_TIMEOUT	(300)	/* ms per response character */
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static uint32_t state_ms(ATParser *at)
+{
+    uint32_t now;
+
+    // 0 marks a group never updated
+    if (!ATCmdParser_clock_ms(at, &now) || now == 0)
+        return 1;
+    return now;
+}
+
+// Single writer side of the seqlock
+static void state_begin(at_state* st)
+{
+    atomic_store_explicit(&st->seq, atomic_load_explicit(&st->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void state_end(at_state* st)
+{
+    st->cur.version++;
+    atomic_store_explicit(&st->seq, atomic_load_explicit(&st->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Line after its prefix split into arguments, raw keeps the quotes
+static int state_args(ATParser *at, char* line, char* args[], char* raw[])
+{
+    int n = ATCmdParser_analyse_args(at, line, raw, STATE_MAX_ARGS);
+    for (int i = 0; i < n; i++) {
+        while (*raw[i] == ' ')
+            raw[i]++;
+        args[i] = raw[i];
+        if (*args[i] == '"')
+            args[i]++;
+        char* e = args[i] + strlen(args[i]);
+        if (e > args[i] && e[-1] == '"')
+            e[-1] = 0;
+    }
+    return n;
+}
+
+static void parse_csq(at_state* st, char* args[], int n)
+{
+    if (n < 2)
+        return;
+    state_begin(st);
+    st->cur.rssi = atoi(args[0]);
+    st->cur.ber = atoi(args[1]);
+    st->cur.csq_ms = state_ms(st->at);
+    state_end(st);
+}
+
+/* "+CREG: <n>,<stat>[,<lac>,<ci>[,<act>]]" answers a query, the URC lacks <n>:
+   "+CREG: <stat>[,<lac>,<ci>[,<act>]]", the location fields are quoted hex */
+static void parse_reg(at_state* st, at_reg_state* reg, uint32_t* stamp, char* args[], int n, char* raw[])
+{
+    int first = (n >= 2 && isdigit((unsigned char)raw[1][0])) ? 1 : 0;
+
+    if (n <= first)
+        return;
+    state_begin(st);
+    reg->stat = atoi(args[first]);
+    reg->lac = n > first + 1 && *args[first + 1] ? (int)strtol(args[first + 1], NULL, 16) : -1;
+    reg->ci = n > first + 2 && *args[first + 2] ? strtol(args[first + 2], NULL, 16) : -1;
+    reg->act = n > first + 3 && *args[first + 3] ? atoi(args[first + 3]) : -1;
+    *stamp = state_ms(st->at);
+    state_end(st);
+}
+
+// "+QISTATE: <id>,"<type>","<ip>",<rport>,<lport>,<state>,..."
+static void parse_qistate(at_state* st, char* args[], int n)
+{
+    if (n < 6)
+        return;
+    int id = atoi(args[0]);
+    if (id < 0 || id > 31)
+        return;
+    bool connected = atoi(args[5]) == 2;
+    if (st->collecting) {
+        if (connected)
+            st->collect |= 1u << id;
+        return;
+    }
+    state_begin(st);
+    if (connected)
+        st->cur.sockets |= 1u << id;
+    else
+        st->cur.sockets &= ~(1u << id);
+    state_end(st);
+}
+
+static void parse_closed(at_state* st, char* args[], int n)
+{
+    int id = n > 0 ? atoi(args[0]) : -1;
+    if (id < 0 || id > 31)
+        return;
+    state_begin(st);
+    st->cur.sockets &= ~(1u << id);
+    state_end(st);
+}
+
+static bool state_prefix(char** line, const char* prefix)
+{
+    size_t n = strlen(prefix);
+
+    if (strncmp(*line, prefix, n) != 0)
+        return false;
+    *line += n;
+    return true;
+}
+
+// Observer: reports and query answers are read, never taken from their reader
+static void state_line(void* arg, const char* text, int len)
+{
+    at_state* st = arg;
+    char buf[STATE_LINE_SIZE];
+    char* line = buf;
+    char* args[STATE_MAX_ARGS];
+    char* raw[STATE_MAX_ARGS];
+
+    if (len > (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    memcpy(buf, text, len);
+    buf[len] = 0;
+    if (*line != '+')
+        return;
+
+    if (state_prefix(&line, "+CSQ:") || state_prefix(&line, "+QIND: \"csq\","))
+        parse_csq(st, args, state_args(st->at, line, args, raw));
+    else if (state_prefix(&line, "+CREG:")) {
+        int n = state_args(st->at, line, args, raw);
+        parse_reg(st, &st->cur.creg, &st->cur.creg_ms, args, n, raw);
+    } else if (state_prefix(&line, "+CEREG:")) {
+        int n = state_args(st->at, line, args, raw);
+        parse_reg(st, &st->cur.cereg, &st->cur.cereg_ms, args, n, raw);
+    } else if (state_prefix(&line, "+QISTATE:"))
+        parse_qistate(st, args, state_args(st->at, line, args, raw));
+    else if (state_prefix(&line, "+QIURC: \"closed\","))
+        parse_closed(st, args, state_args(st->at, line, args, raw));
+}
+
+static void state_reg_unknown(at_reg_state* reg)
+{
+    reg->stat = -1;
+    reg->lac = -1;
+    reg->ci = -1;
+    reg->act = -1;
+}
+
+bool ATCmdState_init(at_state* st, ATParser *at)
+{
+    memset(&st->cur, 0, sizeof(st->cur));
+    st->at = at;
+    atomic_init(&st->seq, 0);
+    st->cur.rssi = 99;
+    st->cur.ber = 99;
+    state_reg_unknown(&st->cur.creg);
+    state_reg_unknown(&st->cur.cereg);
+    st->collect = 0;
+    st->collecting = false;
+
+    st->obs.sent = NULL;
+    st->obs.line = state_line;
+    st->obs.arg = st;
+    ATCmdParser_add_observer(at, &st->obs);
+    return ATCmdState_enable_reports(st);
+}
+
+// Send a command and wait for its final result, the observer saw the information lines
+static bool state_cmd(at_state* st, const char* cmd)
+{
+    char line[32];
+    int timeout = st->at->character_timeout;
+    bool ok = false;
+
+    ATCmdParser_set_timeout(st->at, STATE_TIMEOUT);
+    if (ATCmdParser_send(st->at, "%s", cmd)) {
+        while (ATCmdParser_getline(st->at, line, sizeof(line)) >= 0) {
+            if (strcmp(line, "OK") == 0) {
+                ok = true;
+                break;
+            }
+            if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0)
+                break;
+        }
+    }
+    ATCmdParser_set_timeout(st->at, timeout);
+    return ok;
+}
+
+bool ATCmdState_enable_reports(at_state* st)
+{
+    bool ok = state_cmd(st, "AT+CREG=2");
+    ok = state_cmd(st, "AT+CEREG=2") && ok;
+    state_cmd(st, "AT+QINDCFG=\"csq\",1");
+    return ok;
+}
+
+static bool state_stale(at_state* st, uint32_t stamp, uint32_t max_age_ms)
+{
+    uint32_t now;
+
+    // Without a clock ages are unknown, everything is refreshed
+    if (max_age_ms == 0 || stamp == 0 || !ATCmdParser_clock_ms(st->at, &now))
+        return true;
+    return state_ms(st->at) - stamp >= max_age_ms;
+}
+
+bool ATCmdState_refresh(at_state* st, uint32_t max_age_ms)
+{
+    bool ok = true;
+
+    if (state_stale(st, st->cur.csq_ms, max_age_ms))
+        ok = state_cmd(st, "AT+CSQ") && ok;
+    if (state_stale(st, st->cur.creg_ms, max_age_ms))
+        ok = state_cmd(st, "AT+CREG?") && ok;
+    if (state_stale(st, st->cur.cereg_ms, max_age_ms))
+        ok = state_cmd(st, "AT+CEREG?") && ok;
+    if (state_stale(st, st->cur.sockets_ms, max_age_ms)) {
+        // The query lists every socket, unlisted ones are closed
+        st->collect = 0;
+        st->collecting = true;
+        bool answered = state_cmd(st, "AT+QISTATE?");
+        st->collecting = false;
+        if (answered) {
+            state_begin(st);
+            st->cur.sockets = st->collect;
+            st->cur.sockets_ms = state_ms(st->at);
+            state_end(st);
+        }
+        ok = answered && ok;
+    }
+    return ok;
+}
+
+void ATCmdState_read(at_state* st, at_modem_state* out)
+{
+    unsigned s1, s2;
+
+    do {
+        s1 = atomic_load_explicit(&st->seq, memory_order_acquire);
+        memcpy(out, &st->cur, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+}
@@ -0,0 +1,138 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdState.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_STATE_H_
+#define _AT_CMD_STATE_H_
+
+#include "ATCmdAtomic.h"
+#include "ATCmdParser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Network registration, -1 fields are unknown
+ */
+typedef struct {
+    int stat;                   /* 0 not registered, 1 home, 2 searching, 3 denied, 5 roaming */
+    int lac;                    /* LAC, or TAC for +CEREG */
+    long ci;                    /* cell id */
+    int act;                    /* access technology */
+} at_reg_state;
+
+/**
+ * Modem state snapshot, times are serial_ops tick values or the system clock
+ * in ms on unix, 0 if never updated
+ */
+typedef struct {
+    int rssi;                   /* +CSQ 0..31, 99 unknown */
+    int ber;
+    at_reg_state creg;          /* circuit switched */
+    at_reg_state cereg;         /* EPS */
+    uint32_t sockets;           /* bit per connect ID in state 2 (connected), +QISTATE */
+    uint32_t version;           /* bumped on every change */
+    uint32_t csq_ms;
+    uint32_t creg_ms;
+    uint32_t cereg_ms;
+    uint32_t sockets_ms;
+} at_modem_state;
+
+/**
+ * State store of one parser: the thread driving the parser updates it from
+ * URCs and query responses, any thread reads it through a seqlock
+ */
+typedef struct {
+    ATParser* at;
+    at_atomic_uint seq;         /* odd while an update is in progress */
+    at_modem_state cur;
+    uint32_t collect;           /* sockets seen by the running +QISTATE? */
+    bool collecting;
+    struct at_observer obs;
+} at_state;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Attach a state store to a parser and turn on the reports with
+ *                  #ATCmdState_enable_reports. The store observes "+CSQ:", "+CREG:",
+ *                  "+CEREG:", "+QISTATE:", "+QIND: \"csq\"," and "+QIURC: \"closed\","
+ *                  lines, solicited or not, and leaves them to recv/getline callers
+ * @note    		Call from the thread owning the parser. Lines taken by an
+ *                  out-of-band handler, e.g. one for "+QIURC:", are not seen
+ *
+ * @param[out] 		st: store, must stay valid while the parser is used
+ *
+ * @return 			true: registration reports enabled, the store is attached either way
+ */
+bool ATCmdState_init(at_state* st, ATParser *at);
+
+/**
+ * @brief 			Turn on unsolicited registration (+CREG=2, +CEREG=2) and
+ *                  signal quality (Quectel +QINDCFG="csq") reports, again after
+ *                  the modem was reset
+ * @note    		Call from the thread owning the parser
+ *
+ * @return 			true: registration reports enabled, signal reports are optional
+ */
+bool ATCmdState_enable_reports(at_state* st);
+
+/**
+ * @brief 			Query the groups not updated within max_age_ms, the answers
+ *                  reach the store through its handlers
+ * @note    		Call from the thread owning the parser
+ *
+ * @param[in] 		max_age_ms: 0 refreshes everything, as does any age on
+ *                  targets without a tick hook or system clock
+ *
+ * @return 			true: every query answered OK
+ */
+bool ATCmdState_refresh(at_state* st, uint32_t max_age_ms);
+
+/**
+ * @brief 			Copy a consistent snapshot, lock-free and never touches the port
+ *
+ * @param[out] 		out: snapshot
+ *
+ * @return 			none
+ */
+void ATCmdState_read(at_state* st, at_modem_state* out);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_STATE_H_
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdTimer.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#include <stddef.h>
+
+#include "ATCmdTimer.h"
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static inline void slot_insert(at_timer* head, at_timer* t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static inline void slot_unlink(at_timer* t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+// Slot by distance from the next tick, as the classic kernel timer wheel
+static void wheel_insert(at_timer_wheel* w, at_timer* t)
+{
+    uint32_t delta = t->expires - w->now;
+    int level = 0;
+
+    if ((int32_t)delta < 0) {
+        // Already due, fire on the next tick
+        t->expires = w->now;
+        delta = 0;
+    }
+    while (level < AT_TIMER_LEVELS - 1 && delta >= (1u << ((level + 1) * AT_TIMER_SLOT_BITS)))
+        level++;
+    if (delta >= (1u << (AT_TIMER_LEVELS * AT_TIMER_SLOT_BITS))) {
+        t->expires = w->now + (1u << (AT_TIMER_LEVELS * AT_TIMER_SLOT_BITS)) - 1;
+    }
+    int idx = (t->expires >> (level * AT_TIMER_SLOT_BITS)) & (AT_TIMER_SLOTS - 1);
+    slot_insert(&w->slots[level][idx], t);
+}
+
+void ATCmdTimer_init(at_timer_wheel* w, int tick_ms, uint32_t now_ms)
+{
+    w->tick_ms = tick_ms > 0 ? tick_ms : 1;
+    w->origin_ms = now_ms;
+    w->now = 0;
+    w->clock = 0;
+    w->count = 0;
+    for (int l = 0; l < AT_TIMER_LEVELS; l++) {
+        for (int s = 0; s < AT_TIMER_SLOTS; s++) {
+            w->slots[l][s].next = &w->slots[l][s];
+            w->slots[l][s].prev = &w->slots[l][s];
+        }
+    }
+}
+
+void ATCmdTimer_arm(at_timer_wheel* w, at_timer* timer, int delay_ms, at_timer_callback cb, void* arg)
+{
+    if (timer->next)
+        slot_unlink(timer);
+    else
+        w->count++;
+    if (delay_ms < 0)
+        delay_ms = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+    // Relative to the clock, not to the tick being processed, so callbacks
+    // re-arming during a catch-up never fire early
+    timer->expires = w->clock + (uint32_t)((delay_ms + w->tick_ms - 1) / w->tick_ms);
+    wheel_insert(w, timer);
+}
+
+void ATCmdTimer_cancel(at_timer_wheel* w, at_timer* timer)
+{
+    if (!timer->next)
+        return;
+    slot_unlink(timer);
+    w->count--;
+}
+
+// Move the timers of one upper slot down, they now fall into lower levels
+static void wheel_cascade(at_timer_wheel* w, int level)
+{
+    at_timer* head = &w->slots[level][(w->now >> (level * AT_TIMER_SLOT_BITS)) & (AT_TIMER_SLOTS - 1)];
+
+    while (head->next != head) {
+        at_timer* t = head->next;
+        slot_unlink(t);
+        wheel_insert(w, t);
+    }
+}
+
+int ATCmdTimer_advance(at_timer_wheel* w, uint32_t now_ms)
+{
+    uint32_t target = (now_ms - w->origin_ms) / w->tick_ms;
+    int fired = 0;
+
+    w->clock = target + 1;
+    while ((int32_t)(target - w->now) >= 0) {
+        if (w->count == 0) {
+            // Nothing armed, skip the idle ticks at once
+            w->now = target + 1;
+            break;
+        }
+        for (int level = 1; level < AT_TIMER_LEVELS; level++) {
+            if ((w->now >> ((level - 1) * AT_TIMER_SLOT_BITS)) & (AT_TIMER_SLOTS - 1))
+                break;
+            wheel_cascade(w, level);
+        }
+
+        // Detach the slot first, a callback re-arming 63 ticks ahead lands in it
+        at_timer* slot = &w->slots[0][w->now & (AT_TIMER_SLOTS - 1)];
+        at_timer expired;
+        w->now++;
+        if (slot->next == slot)
+            continue;
+        expired.next = slot->next;
+        expired.prev = slot->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        slot->next = slot;
+        slot->prev = slot;
+
+        while (expired.next != &expired) {
+            at_timer* t = expired.next;
+            slot_unlink(t);
+            w->count--;
+            fired++;
+            t->cb(t, t->arg);
+        }
+    }
+    return fired;
+}
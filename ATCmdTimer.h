@@ -0,0 +1,126 @@
+/**
+ ******************************************************************************
+ * @file    ATCmdTimer.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_CMD_TIMER_H_
+#define _AT_CMD_TIMER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \addtogroup AT_parser */
+/** @{*/
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define AT_TIMER_SLOT_BITS	(6)
+#define AT_TIMER_SLOTS		(1 << AT_TIMER_SLOT_BITS)
+#define AT_TIMER_LEVELS		(4)		/* 2^24 ticks, longer delays are clamped */
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+struct at_timer;
+typedef void (*at_timer_callback)(struct at_timer* timer, void* arg);
+
+/**
+ * Timer node, embedded in the owner so arming never allocates
+ */
+typedef struct at_timer {
+    struct at_timer* next;          /* NULL while not armed */
+    struct at_timer* prev;
+    uint32_t expires;               /* tick */
+    at_timer_callback cb;
+    void* arg;
+} at_timer;
+
+/**
+ * Hierarchical timer wheel: level 0 holds the next 64 ticks one slot per
+ * tick, each further level covers 64 times the range of the one below and is
+ * cascaded down as time reaches it. Not locked, the owner serialises access.
+ */
+typedef struct {
+    int tick_ms;
+    uint32_t origin_ms;             /* time of tick 0 */
+    uint32_t now;                   /* next tick to process */
+    uint32_t clock;                 /* first tick after the time of the last advance */
+    int count;                      /* armed timers */
+    at_timer slots[AT_TIMER_LEVELS][AT_TIMER_SLOTS];
+} at_timer_wheel;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+/**
+ * @brief 			Initialize an empty wheel
+ *
+ * @param[in] 		tick_ms: resolution, timers fire up to one tick late, never early
+ * @param[in] 		now_ms: current monotonic time in milliseconds
+ *
+ * @return 			none
+ */
+void ATCmdTimer_init(at_timer_wheel* w, int tick_ms, uint32_t now_ms);
+
+/**
+ * @brief 			Arm a timer, re-arming an armed timer moves it, O(1)
+ *
+ * @param[in] 		timer: node, must stay valid while armed
+ * @param[in] 		delay_ms: time from the last #ATCmdTimer_advance
+ * @param[in] 		cb: called from #ATCmdTimer_advance, the timer is already
+ *                  disarmed and may be armed again inside
+ *
+ * @return 			none
+ */
+void ATCmdTimer_arm(at_timer_wheel* w, at_timer* timer, int delay_ms, at_timer_callback cb, void* arg);
+
+/**
+ * @brief 			Disarm a timer, O(1), does nothing if it is not armed
+ */
+void ATCmdTimer_cancel(at_timer_wheel* w, at_timer* timer);
+
+static inline bool ATCmdTimer_pending(const at_timer* timer)
+{
+    return timer->next != 0;
+}
+
+/**
+ * @brief 			Process every tick up to now_ms, firing expired timers
+ *
+ * @param[in] 		now_ms: current monotonic time in milliseconds
+ *
+ * @return 			number of timers fired
+ */
+int ATCmdTimer_advance(at_timer_wheel* w, uint32_t now_ms);
+
+/** @}*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //_AT_CMD_TIMER_H_
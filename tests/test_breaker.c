@@ -0,0 +1,198 @@
+/**
+ ******************************************************************************
+ * @file    test_breaker.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Circuit breaker transitions: each case is a script of timeouts, received
+ * lines, sends and waits on a fake tick, checked after every event against
+ * the expected result and breaker state. Threshold 3, open 100 ms, max 400 ms.
+ *
+ * Build: cc -I. tests/test_breaker.c ATCmdParser.c -o test_breaker
+ * Usage: test_breaker, exits non-zero on a failed case
+ */
+
+#include <stdio.h>
+
+#include "ATCmdParser.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define BREAKER_MAX_EVENTS	(16)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef enum {
+    EV_END = 0,
+    EV_TIMEOUT,                 /* recv on a silent port */
+    EV_LINE,                    /* recv of an answered "OK" */
+    EV_SEND,
+    EV_WAIT,                    /* advance the tick by arg ms */
+    EV_SYNC,                    /* sync against a modem answering OK */
+} breaker_op;
+
+typedef struct {
+    breaker_op op;
+    int arg;
+    bool ok;                    /* expected result, ignored for waits */
+    at_breaker_state state;     /* expected state afterwards */
+} breaker_event;
+
+typedef struct {
+    const char* name;
+    breaker_event events[BREAKER_MAX_EVENTS];
+} breaker_case;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+#define C AT_BREAKER_CLOSED
+#define O AT_BREAKER_OPEN
+#define H AT_BREAKER_HALF_OPEN
+
+static const breaker_case cases[] = {
+    { "opens at the threshold", {
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, O },
+        { EV_SEND, 0, false, O }, { EV_LINE, 0, false, O } } },
+    { "a line resets the count", {
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_LINE, 0, true, C },
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, O } } },
+    { "a probe line closes", {
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, O },
+        { EV_WAIT, 99, false, O }, { EV_SEND, 0, false, O }, { EV_WAIT, 1, false, O },
+        { EV_SEND, 0, true, H }, { EV_LINE, 0, true, C }, { EV_TIMEOUT, 0, false, C } } },
+    { "failed probes back off to the maximum", {
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, O },
+        { EV_WAIT, 100, false, O }, { EV_TIMEOUT, 0, false, O },
+        { EV_WAIT, 199, false, O }, { EV_SEND, 0, false, O }, { EV_WAIT, 1, false, O },
+        { EV_TIMEOUT, 0, false, O }, { EV_WAIT, 400, false, O }, { EV_TIMEOUT, 0, false, O },
+        { EV_WAIT, 399, false, O }, { EV_SEND, 0, false, O }, { EV_WAIT, 1, false, O },
+        { EV_SEND, 0, true, H } } },
+    { "sync is never blocked and closes", {
+        { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, C }, { EV_TIMEOUT, 0, false, O },
+        { EV_SYNC, 0, true, C }, { EV_SEND, 0, true, C } } },
+};
+
+#undef C
+#undef O
+#undef H
+
+static const char* rx = "";
+static uint32_t tick;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static int mem_get(int timeout)
+{
+    (void)timeout;
+    return *rx ? (unsigned char)*rx++ : -1;
+}
+
+// Every command is answered while the script wants answers
+static const char* answer;
+
+static int mem_put(char c)
+{
+    if (c == '\r' && answer)
+        rx = answer;
+    return 0;
+}
+
+static int mem_readable()
+{
+    return *rx != 0;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static uint32_t mem_tick(void)
+{
+    return tick;
+}
+
+static bool run_event(ATParser *at, const breaker_event* ev)
+{
+    rx = "";
+    answer = NULL;
+    switch (ev->op) {
+    case EV_TIMEOUT:
+        return ATCmdParser_recv(at, "OK");
+    case EV_LINE:
+        rx = "OK\r\n";
+        return ATCmdParser_recv(at, "OK");
+    case EV_SEND:
+        return ATCmdParser_send(at, "AT");
+    case EV_WAIT:
+        tick += ev->arg;
+        return false;
+    case EV_SYNC:
+        answer = "OK\r\n";
+        return ATCmdParser_sync(at, 1000, NULL);
+    default:
+        return false;
+    }
+}
+
+static bool run_case(const breaker_case* c)
+{
+    static serial_ops ops = { .get = mem_get, .put = mem_put, .readable = mem_readable, .init = mem_init,
+                              .tick = mem_tick };
+    ATParser at;
+
+    tick = 1000;
+    ATCmdParser_init_static(&at, &ops, "\r", "\r\n", 10, false);
+    if (!ATCmdParser_set_breaker(&at, 3, 100, 400)) {
+        printf("FAIL %s: breaker not enabled\n", c->name);
+        return false;
+    }
+    for (int i = 0; i < BREAKER_MAX_EVENTS && c->events[i].op != EV_END; i++) {
+        const breaker_event* ev = &c->events[i];
+        bool ok = run_event(&at, ev);
+        at_breaker_state state = ATCmdParser_breaker_state(&at);
+
+        if ((ev->op != EV_WAIT && ok != ev->ok) || state != ev->state) {
+            printf("FAIL %s: event %d returned %d in state %d, expected %d in state %d\n", c->name, i, ok, state,
+                   ev->ok, ev->state);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    int failed = 0;
+    int n = sizeof(cases) / sizeof(cases[0]);
+
+    for (int i = 0; i < n; i++) {
+        if (!run_case(&cases[i]))
+            failed++;
+    }
+    printf("%d of %d breaker cases passed\n", n - failed, n);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+/**
+ ******************************************************************************
+ * @file    test_garbage.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Garbage filter: each case reads its input with getline under the given
+ * limits, once through a port with serial_ops skip and once without, and
+ * compares the lines kept and the garbage counted with the table.
+ *
+ * Build: cc -I. tests/test_garbage.c ATCmdParser.c -o test_garbage
+ * Usage: test_garbage, exits non-zero on a failed case
+ */
+
+#include <stdio.h>
+
+#include "ATCmdParser.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    int max_line;
+    int max_binary;
+    const char* input;
+    const char* lines;          /* kept lines joined by '|' */
+    uint32_t garbage_lines;
+    uint64_t garbage_bytes;
+} garbage_case;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static const garbage_case cases[] = {
+    // Binary filtering is off by default
+    { 0, 0, "A\x01\x02\x03\x04" "B\r\nOK\r\n", "A\x01\x02\x03\x04" "B|OK", 0, 0 },
+    { 0, AT_GARBAGE_BINARY, "\x01\x02\x03\x04junk\r\nOK\r\n", "OK", 1, 10 },
+    { 0, AT_GARBAGE_BINARY, "x\x01\x02\x03y\r\nOK\r\n", "x\x01\x02\x03y|OK", 0, 0 },
+    { 0, 1, "\x7f\r\nOK\r\n", "OK", 1, 3 },
+    // Tabs and the delimiter are text
+    { 0, 1, "\tA\tB\r\nOK\r\n", "\tA\tB|OK", 0, 0 },
+    { 8, 0, "0123456789ABCDEF\r\nOK\r\n", "OK", 1, 18 },
+    { 8, 0, "ABCDE\r\nOK\r\n", "ABCDE|OK", 0, 0 },
+    // Bytes above 0x7f are text
+    { 16, AT_GARBAGE_BINARY, "\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8\xf7\r\n+CSQ: 1,2\r\n",
+      "\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8\xf7|+CSQ: 1,2", 0, 0 },
+    // A garbage line cut short by a timeout leaves nothing behind
+    { 0, AT_GARBAGE_BINARY, "OK\r\n\x01\x02\x03\x04", "OK", 1, 4 },
+};
+
+static const char* rx;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static int mem_get(int timeout)
+{
+    (void)timeout;
+    return *rx ? (unsigned char)*rx++ : -1;
+}
+
+static int mem_put(char c)
+{
+    (void)c;
+    return 0;
+}
+
+static int mem_readable()
+{
+    return *rx != 0;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static int mem_skip(char delim)
+{
+    const char* p = strchr(rx, delim);
+    int n = p ? p - rx : (int)strlen(rx);
+
+    rx += n;
+    return n;
+}
+
+static bool run_case(const garbage_case* c, bool skip)
+{
+    static serial_ops ops = { .get = mem_get, .put = mem_put, .readable = mem_readable, .init = mem_init };
+    ATParser at;
+    ATParserStats stats;
+    char lines[256] = "";
+    char line[64];
+
+    ops.skip = skip ? mem_skip : NULL;
+    rx = c->input;
+    ATCmdParser_init_static(&at, &ops, "\r", "\r\n", 10, false);
+    ATCmdParser_set_garbage_filter(&at, c->max_line, c->max_binary);
+    while (ATCmdParser_getline(&at, line, sizeof(line)) >= 0) {
+        if (lines[0])
+            strcat(lines, "|");
+        strcat(lines, line);
+    }
+    ATCmdParser_get_stats(&at, &stats);
+
+    if (strcmp(lines, c->lines) != 0 || stats.garbage_lines != c->garbage_lines
+            || stats.garbage_bytes != c->garbage_bytes) {
+        printf("FAIL limits %d/%d%s: kept \"%s\", %u garbage lines of %llu bytes\n", c->max_line, c->max_binary,
+               skip ? " with skip" : "", lines, stats.garbage_lines, (unsigned long long)stats.garbage_bytes);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    int failed = 0;
+    int n = sizeof(cases) / sizeof(cases[0]);
+
+    for (int i = 0; i < n; i++) {
+        if (!run_case(&cases[i], false) || !run_case(&cases[i], true))
+            failed++;
+    }
+    printf("%d of %d garbage cases passed\n", n - failed, n);
+    return failed ? 1 : 0;
+}
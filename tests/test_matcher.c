@@ -0,0 +1,190 @@
+/**
+ ******************************************************************************
+ * @file    test_matcher.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Fast matcher against sscanf: every case runs the check-only format recv
+ * builds through both engines and compares the matched length with the
+ * table, then runs recv on the whole line with each engine and compares the
+ * stored values. The parser source is included to reach the static engines.
+ *
+ * Build: cc -I. tests/test_matcher.c -o test_matcher
+ * Usage: test_matcher, exits non-zero on a failed case
+ */
+
+#include "ATCmdParser.c"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    const char* fmt;            /* recv format, ints or one string */
+    const char* input;          /* line as received so far */
+    int count;                  /* characters matched, -1: not (yet) matched */
+    int nvals;                  /* int values recv stores */
+    int vals[3];
+    const char* str;            /* or the string value, NULL none */
+} match_case;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static const match_case cases[] = {
+    { "+CSQ: %d,%d", "+CSQ: 21,99", 11, 2, { 21, 99 }, NULL },
+    { "+CSQ: %d,%d", "+CSQ: 21,", -1, 0, { 0 }, NULL },
+    { "+CSQ: %d,%d", "+CSQ: 21", -1, 0, { 0 }, NULL },
+    { "+CSQ: %d,%d", "+CREG: 1", -1, 0, { 0 }, NULL },
+    { "+CSQ:%d", "+CSQ:   -7", 10, 1, { -7 }, NULL },
+    { "%d", "+12", 3, 1, { 12 }, NULL },
+    { "%u,%u", "3,4", 3, 2, { 3, 4 }, NULL },
+    { "%x", "1a2B", 4, 1, { 0x1a2b }, NULL },
+    { "%x", "0x1f", 4, 1, { 0x1f }, NULL },
+    { "%i", "0x10", 4, 1, { 16 }, NULL },
+    { "%i", "010", 3, 1, { 8 }, NULL },
+    { "%2d%d", "12345", 5, 2, { 12, 345 }, NULL },
+    { "\"%x\",\"%x\"", "\"1A2B\",\"00C0FFEE\"", 17, 2, { 0x1a2b, 0xc0ffee }, NULL },
+    { "+QIRD: %d", "+QIRD: 512", 10, 1, { 512 }, NULL },
+    { "100%% %d", "100% 5", 6, 1, { 5 }, NULL },
+    { "OK", "OK", 2, 0, { 0 }, NULL },
+    { "OK", "ERROR", -1, 0, { 0 }, NULL },
+    { "%s", "hello", 5, 0, { 0 }, "hello" },
+    { "+CGSN: %s", "+CGSN: 861234567890123", 22, 0, { 0 }, "861234567890123" },
+    { "%[^,],%d", "tcp,5", 5, 0, { 0 }, NULL },
+    { "+QIURC: \"%[a-z]\"", "+QIURC: \"recv\"", 14, 0, { 0 }, "recv" },
+    { "%3c", "abcdef", 3, 0, { 0 }, NULL },
+    { "%f", "1.5e", 4, 0, { 0 }, NULL },
+    { "%f", "1.5e+", 5, 0, { 0 }, NULL },
+    { "%f", "1.5e3", 5, 0, { 0 }, NULL },
+    { "%f", "-.", -1, 0, { 0 }, NULL },
+    { "%d", "x", -1, 0, { 0 }, NULL },
+    { "%d %d", "1 2", 3, 2, { 1, 2 }, NULL },
+};
+
+static const char* rx;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static int mem_get(int timeout)
+{
+    (void)timeout;
+    return *rx ? (unsigned char)*rx++ : -1;
+}
+
+static int mem_put(char c)
+{
+    (void)c;
+    return 0;
+}
+
+static int mem_readable()
+{
+    return *rx != 0;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+// The check-only format recv builds: conversions suppressed, %n appended
+static void check_format(const char* fmt, char* out)
+{
+    while (*fmt) {
+        if (fmt[0] == '%' && fmt[1] != '%' && fmt[1] != '*') {
+            *out++ = '%';
+            *out++ = '*';
+            fmt++;
+        } else if (fmt[0] == '%' && fmt[1] == '%') {
+            *out++ = *fmt++;
+            *out++ = *fmt++;
+        } else {
+            *out++ = *fmt++;
+        }
+    }
+    strcpy(out, "%n");
+}
+
+static bool run_engines(const match_case* t)
+{
+    char fmt[128];
+    int len = strlen(t->input);
+    int scanned = -1;
+    bool dead;
+
+    check_format(t->fmt, fmt);
+    sscanf(t->input, fmt, &scanned);
+    int fast = fast_match(fmt, t->input, len, &dead);
+    if (scanned != t->count || (fast != FAST_UNSUPPORTED && fast != t->count)) {
+        printf("FAIL %-24s \"%s\": sscanf %d, fast %d, expected %d\n", t->fmt, t->input, scanned, fast, t->count);
+        return false;
+    }
+    return true;
+}
+
+static bool run_recv(const match_case* t, at_matcher matcher)
+{
+    static serial_ops ops = { .get = mem_get, .put = mem_put, .readable = mem_readable, .init = mem_init };
+    ATParser at;
+    char line[128];
+    char fmt[128];
+    int v[3] = { 0 };
+    char s[64] = "";
+    bool ok;
+
+    // A trailing newline makes recv wait for the whole line
+    snprintf(line, sizeof(line), "%s\r\n", t->input);
+    snprintf(fmt, sizeof(fmt), "%s\n", t->fmt);
+    rx = line;
+    ATCmdParser_init_static(&at, &ops, "\r", "\r\n", 10, false);
+    ATCmdParser_set_matcher(&at, matcher);
+    if (t->str)
+        ok = ATCmdParser_recv(&at, fmt, s);
+    else
+        ok = ATCmdParser_recv(&at, fmt, &v[0], &v[1], &v[2]);
+
+    bool pass = ok && (t->str ? strcmp(s, t->str) == 0 : memcmp(v, t->vals, t->nvals * sizeof(int)) == 0);
+    if (!pass)
+        printf("FAIL %-24s \"%s\": recv with matcher %d stored %d,%d,%d \"%s\"\n", t->fmt, t->input, matcher,
+               v[0], v[1], v[2], s);
+    return pass;
+}
+
+int main(void)
+{
+    int failed = 0;
+    int n = sizeof(cases) / sizeof(cases[0]);
+
+    for (int i = 0; i < n; i++) {
+        const match_case* t = &cases[i];
+
+        if (!run_engines(t))
+            failed++;
+        // Values only for lines that match whole
+        if (t->count != (int)strlen(t->input) || (!t->nvals && !t->str))
+            continue;
+        if (!run_recv(t, AT_MATCHER_SSCANF) || !run_recv(t, AT_MATCHER_FAST))
+            failed++;
+    }
+    printf("%d of %d matcher cases passed\n", n - failed, n);
+    return failed ? 1 : 0;
+}
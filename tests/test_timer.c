@@ -0,0 +1,177 @@
+/**
+ ******************************************************************************
+ * @file    test_timer.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Timer wheel: each case arms one timer and advances the clock in steps,
+ * the timer must fire once, never before its delay and at most one tick
+ * plus one step after it, across every level and a clock wrap.
+ * Cancel, re-arm from a callback and catch-up after a stall follow.
+ *
+ * Build: cc -I. tests/test_timer.c ATCmdTimer.c -o test_timer
+ * Usage: test_timer, exits non-zero on a failed case
+ */
+
+#include <stdio.h>
+
+#include "ATCmdTimer.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef struct {
+    int tick_ms;
+    uint32_t start_ms;
+    int delay_ms;
+    int step_ms;                /* clock advance per call */
+} timer_case;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static const timer_case cases[] = {
+    { 1, 1000, 0, 1 },
+    { 1, 1000, 1, 1 },
+    { 1, 1000, 63, 1 },
+    { 1, 1000, 64, 1 },
+    { 1, 1000, 65, 1 },
+    { 1, 1000, 4095, 7 },
+    { 1, 1000, 4096, 7 },
+    { 1, 1000, 300000, 97 },
+    { 10, 1000, 5, 1 },
+    { 10, 1000, 10, 3 },
+    { 10, 1000, 12345, 50 },
+    { 10, 0xFFFFFF00u, 1000, 10 },      /* clock wraps while armed */
+    { 1, 1000, -5, 1 },                 /* negative delays fire at once */
+};
+
+static int fired;
+static uint32_t fired_at;
+static uint32_t clock_ms;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static void on_fire(at_timer* t, void* arg)
+{
+    (void)t;
+    (void)arg;
+    fired++;
+    fired_at = clock_ms;
+}
+
+static bool run_case(const timer_case* c)
+{
+    at_timer_wheel w;
+    at_timer t = { 0 };
+    int delay = c->delay_ms < 0 ? 0 : c->delay_ms;
+    uint32_t late = c->tick_ms + c->step_ms;
+
+    clock_ms = c->start_ms;
+    fired = 0;
+    ATCmdTimer_init(&w, c->tick_ms, clock_ms);
+    ATCmdTimer_arm(&w, &t, c->delay_ms, on_fire, NULL);
+    while (!fired && clock_ms - c->start_ms <= (uint32_t)delay + late) {
+        clock_ms += c->step_ms;
+        ATCmdTimer_advance(&w, clock_ms);
+    }
+
+    uint32_t after = fired_at - c->start_ms;
+    if (fired != 1 || after < (uint32_t)delay || after > delay + late || ATCmdTimer_pending(&t)) {
+        printf("FAIL tick %d delay %d step %d: fired %d after %u ms\n", c->tick_ms, c->delay_ms, c->step_ms,
+               fired, after);
+        return false;
+    }
+    return true;
+}
+
+static void on_rearm(at_timer* t, void* arg)
+{
+    at_timer_wheel* w = arg;
+
+    fired++;
+    if (fired < 3)
+        ATCmdTimer_arm(w, t, 100, on_rearm, w);
+}
+
+static bool run_sequences(void)
+{
+    at_timer_wheel w;
+    at_timer a = { 0 }, b = { 0 };
+    bool ok = true;
+
+    // A cancelled timer never fires, the other one still does
+    ATCmdTimer_init(&w, 1, 0);
+    fired = 0;
+    ATCmdTimer_arm(&w, &a, 50, on_fire, NULL);
+    ATCmdTimer_arm(&w, &b, 50, on_fire, NULL);
+    ATCmdTimer_cancel(&w, &a);
+    ATCmdTimer_cancel(&w, &a);
+    clock_ms = 200;
+    if (ATCmdTimer_advance(&w, clock_ms) != 1 || fired != 1 || w.count != 0) {
+        printf("FAIL cancel: fired %d, %d armed\n", fired, w.count);
+        ok = false;
+    }
+
+    // Re-arming moves the timer instead of adding it twice
+    ATCmdTimer_init(&w, 1, 0);
+    fired = 0;
+    ATCmdTimer_arm(&w, &a, 10, on_fire, NULL);
+    ATCmdTimer_arm(&w, &a, 500, on_fire, NULL);
+    ATCmdTimer_advance(&w, 100);
+    if (fired != 0 || w.count != 1) {
+        printf("FAIL re-arm: fired %d early, %d armed\n", fired, w.count);
+        ok = false;
+    }
+
+    // One advance over a long stall fires each re-arm only when it is due
+    ATCmdTimer_init(&w, 1, 0);
+    a.next = NULL;              /* still linked into the old wheel */
+    fired = 0;
+    ATCmdTimer_arm(&w, &a, 100, on_rearm, &w);
+    ATCmdTimer_advance(&w, 1000);
+    if (fired != 1 || !ATCmdTimer_pending(&a)) {
+        printf("FAIL catch-up: fired %d times in one advance\n", fired);
+        ok = false;
+    }
+    ATCmdTimer_advance(&w, 1101);
+    ATCmdTimer_advance(&w, 1202);
+    if (fired != 3 || ATCmdTimer_pending(&a)) {
+        printf("FAIL re-arm from callback: fired %d times\n", fired);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(void)
+{
+    int failed = 0;
+    int n = sizeof(cases) / sizeof(cases[0]);
+
+    for (int i = 0; i < n; i++) {
+        if (!run_case(&cases[i]))
+            failed++;
+    }
+    if (!run_sequences())
+        failed++;
+    printf("%d of %d timer cases passed\n", n + 1 - failed, n + 1);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+/**
+ ******************************************************************************
+ * @file    at_alloc_bench.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Steady-state allocation check: interposes the glibc allocator, aligned
+ * allocations and free included, runs the send/recv/process_oob/analyse_args
+ * workloads on an in-memory port with the parser built allocation-free, and
+ * reports ns, heap allocations and frees per op. Exits non-zero if any
+ * workload allocated or freed.
+ *
+ * Build: cc -O2 -DATCMDPARSER_NO_MALLOC -I. tools/at_alloc_bench.c ATCmdParser.c -o at_alloc_bench
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "ATCmdParser.h"
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void __libc_free(void* p);
+
+static volatile bool counting;
+static unsigned long allocations;
+static unsigned long frees;
+
+static const char* rx;
+static const char* rx_start;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+void* malloc(size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void* valloc(size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_valloc(size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)))
+        return EINVAL;
+    if (counting)
+        allocations++;
+    *p = __libc_memalign(alignment, size);
+    return *p || !size ? 0 : ENOMEM;
+}
+
+void free(void* p)
+{
+    if (counting && p)
+        frees++;
+    __libc_free(p);
+}
+
+static int mem_get(int timeout)
+{
+    (void)timeout;
+    if (!*rx)
+        rx = rx_start;
+    return (unsigned char)*rx++;
+}
+
+static int mem_put(char c)
+{
+    (void)c;
+    return 0;
+}
+
+static int mem_readable()
+{
+    return *rx_start != 0;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static void urc_cb(void* arg)
+{
+    char line[64];
+    ATCmdParser_getline(arg, line, sizeof(line));
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static ATParser parser;
+static struct oob urc_node;
+static at_template qird;
+
+static void op_send(void)
+{
+    ATCmdParser_send(&parser, "AT+QIRD=%d,%d", 1, 512);
+}
+
+static void op_send_template(void)
+{
+    ATCmdParser_send_template(&parser, &qird, 1, 512);
+}
+
+static void op_recv(void)
+{
+    int a, b;
+    ATCmdParser_recv(&parser, "+CSQ: %d,%d\r\nOK", &a, &b);
+}
+
+static void op_getline(void)
+{
+    char line[64];
+    ATCmdParser_getline(&parser, line, sizeof(line));
+}
+
+static void op_process_oob(void)
+{
+    ATCmdParser_process_oob(&parser);
+}
+
+static void op_analyse_args(void)
+{
+    char args[] = "1,\"tcp\",\"10.0.0.1\\,x\",8080,0,5";
+    char* list[8];
+    ATCmdParser_analyse_args(&parser, args, list, 8);
+}
+
+static bool run(const char* name, void (*op)(void), const char* input, int iterations)
+{
+    rx = rx_start = input;
+    for (int i = 0; i < 100; i++)
+        op();
+
+    allocations = 0;
+    frees = 0;
+    counting = true;
+    uint64_t t = now_ns();
+    for (int i = 0; i < iterations; i++)
+        op();
+    t = now_ns() - t;
+    counting = false;
+
+    printf("%-16s %8.1f ns/op %8.3f allocs/op %8.3f frees/op\n", name, (double)t / iterations,
+           (double)allocations / iterations, (double)frees / iterations);
+    return allocations == 0 && frees == 0;
+}
+
+int main(void)
+{
+    static serial_ops ops = { .get = mem_get, .put = mem_put, .readable = mem_readable, .init = mem_init };
+    const int n = 200000;
+    bool ok = true;
+
+    ATCmdParser_init_static(&parser, &ops, "\r", "\r\n", 10, false);
+    ATCmdParser_add_oob_static(&parser, &urc_node, "+QIURC:", urc_cb);
+    ATCmdParser_template_compile(&qird, "AT+QIRD=%d,%d");
+
+    ok &= run("send", op_send, "", n);
+    ok &= run("send_template", op_send_template, "", n);
+    ok &= run("recv", op_recv, "\r\n+CSQ: 21,99\r\n\r\nOK\r\n", n);
+    ok &= run("getline", op_getline, "\r\n+CSQ: 21,99\r\n", n);
+    ok &= run("process_oob", op_process_oob, "\r\n+QIURC: \"recv\",0\r\n", n);
+    ok &= run("analyse_args", op_analyse_args, "", n);
+
+    printf("%s\n", ok ? "PASS: no steady-state allocations" : "FAIL: heap used in steady state");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+/**
+ ******************************************************************************
+ * @file    at_emu.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "at_emu.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+struct at_emu {
+    at_emu_config cfg;
+    int master;
+    int slave;
+    atomic_bool stop;
+    atomic_bool quiet;
+    bool threaded;
+    pthread_t thread;
+    unsigned seed;
+    uint64_t next_urc;
+    int line_len;
+    char line[256];
+    char out[AT_BUFFER_SIZE * 4];
+};
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+uint64_t at_emu_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void emu_write(int fd, const char* data, int len)
+{
+    while (len > 0) {
+        int n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static inline bool emu_fault(at_emu* emu, int ppm)
+{
+    return ppm > 0 && rand_r(&emu->seed) % 1000000 < ppm;
+}
+
+int at_emu_answer(at_emu* emu, const char* cmd, char* out)
+{
+    int id, len, n = 0;
+
+    if (emu->cfg.response_delay_us)
+        usleep(emu->cfg.response_delay_us);
+    if (emu_fault(emu, emu->cfg.drop_ppm))
+        return 0;
+    if (emu_fault(emu, emu->cfg.stall_ppm))
+        usleep(emu->cfg.stall_us);
+    if (emu_fault(emu, emu->cfg.garbage_ppm)) {
+        for (int i = 0; i < 256; i++) {
+            char c = rand_r(&emu->seed) & 0xff;
+            out[n++] = c == '\n' ? 0 : c;
+        }
+        out[n++] = '\n';
+    }
+
+    if (strcmp(cmd, "AT") == 0 || strcmp(cmd, "ATE0") == 0) {
+        n += sprintf(out + n, "\r\nOK\r\n");
+    } else if (strcmp(cmd, "AT+CSQ") == 0) {
+        n += sprintf(out + n, "\r\n+CSQ: 23,99\r\n\r\nOK\r\n");
+    } else if (sscanf(cmd, "AT+QIRD=%d,%d", &id, &len) == 2 && len >= 0 && len < AT_BUFFER_SIZE * 3) {
+        n += sprintf(out + n, "\r\n+QIRD: %d\r\n", len);
+        for (int i = 0; i < len; i++)
+            out[n++] = 'a' + i % 26;
+        n += sprintf(out + n, "\r\n\r\nOK\r\n");
+    } else {
+        n += sprintf(out + n, "\r\nERROR\r\n");
+    }
+    return n;
+}
+
+int at_emu_urcs(at_emu* emu, uint64_t now, char* out)
+{
+    int n = 0;
+
+    if (!emu->cfg.urc_interval_us || now < emu->next_urc || atomic_load(&emu->quiet))
+        return 0;
+    for (int i = 0; i < (emu->cfg.urc_burst > 0 ? emu->cfg.urc_burst : 1) && n < AT_BUFFER_SIZE * 3; i++)
+        n += sprintf(out + n, "\r\n+QIURC: \"recv\",0,%llu\r\n", (unsigned long long)now);
+    emu->next_urc = now + emu->cfg.urc_interval_us * 1000ull;
+    return n;
+}
+
+uint64_t at_emu_next_urc(at_emu* emu)
+{
+    return emu->cfg.urc_interval_us && !atomic_load(&emu->quiet) ? emu->next_urc : UINT64_MAX;
+}
+
+void at_emu_quiet(at_emu* emu)
+{
+    atomic_store(&emu->quiet, true);
+}
+
+static void* emu_thread(void* arg)
+{
+    at_emu* emu = arg;
+    char buf[256];
+
+    while (!atomic_load(&emu->stop)) {
+        int wait = 50;
+        if (emu->cfg.urc_interval_us && !atomic_load(&emu->quiet)) {
+            uint64_t now = at_emu_now_ns();
+            int n = at_emu_urcs(emu, now, emu->out);
+            if (n)
+                emu_write(emu->master, emu->out, n);
+            wait = (emu->next_urc - now) / 1000000;
+        }
+
+        struct pollfd pfd = { emu->master, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0)
+            continue;
+
+        int n = read(emu->master, buf, sizeof(buf));
+        for (int i = 0; i < n; i++) {
+            if (buf[i] == '\r' || buf[i] == '\n') {
+                if (emu->line_len) {
+                    emu->line[emu->line_len] = 0;
+                    emu_write(emu->master, emu->out, at_emu_answer(emu, emu->line, emu->out));
+                    emu->line_len = 0;
+                }
+            } else if (emu->line_len + 1 < (int)sizeof(emu->line)) {
+                emu->line[emu->line_len++] = buf[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+at_emu *at_emu_open(const at_emu_config* cfg)
+{
+    at_emu* emu = calloc(1, sizeof(at_emu));
+
+    if (!emu)
+        return NULL;
+    emu->cfg = *cfg;
+    emu->master = -1;
+    emu->slave = -1;
+    emu->seed = cfg->seed;
+    emu->next_urc = at_emu_now_ns() + cfg->urc_interval_us * 1000ull;
+    return emu;
+}
+
+at_emu *at_emu_start(const at_emu_config* cfg)
+{
+    struct termios tio;
+    at_emu* emu = at_emu_open(cfg);
+    const char* name;
+
+    if (!emu)
+        return NULL;
+    emu->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (emu->master < 0 || grantpt(emu->master) < 0 || unlockpt(emu->master) < 0
+            || !(name = ptsname(emu->master)))
+        goto fail;
+    emu->slave = open(name, O_RDWR | O_NOCTTY);
+    if (emu->slave < 0)
+        goto fail;
+
+    tcgetattr(emu->slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(emu->slave, TCSANOW, &tio);
+    fcntl(emu->master, F_SETFL, O_NONBLOCK);
+    fcntl(emu->slave, F_SETFL, O_NONBLOCK);
+
+    emu->threaded = pthread_create(&emu->thread, NULL, emu_thread, emu) == 0;
+    if (emu->threaded)
+        return emu;
+fail:
+    if (emu->slave >= 0)
+        close(emu->slave);
+    if (emu->master >= 0)
+        close(emu->master);
+    free(emu);
+    return NULL;
+}
+
+int at_emu_fd(at_emu* emu)
+{
+    return emu->slave;
+}
+
+void at_emu_stop(at_emu* emu)
+{
+    if (emu->threaded) {
+        atomic_store(&emu->stop, true);
+        pthread_join(emu->thread, NULL);
+        close(emu->slave);
+        close(emu->master);
+    }
+    free(emu);
+}
+
+/* Host side serial_ops, the port comes from the parser being driven */
+
+static at_pty_port* pty_port(void)
+{
+    return ATCmdParser_priv(ATCmdParser_current());
+}
+
+static void pty_flush(at_pty_port* port)
+{
+    if (port->tx_len) {
+        emu_write(port->fd, port->tx, port->tx_len);
+        port->tx_len = 0;
+    }
+}
+
+static int pty_get(int timeout)
+{
+    at_pty_port* port = pty_port();
+
+    pty_flush(port);
+    while (port->rx_pos == port->rx_len) {
+        struct pollfd pfd = { port->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout) <= 0)
+            return -1;
+        int n = read(port->fd, port->rx, sizeof(port->rx));
+        if (n <= 0)
+            continue;
+        port->rx_pos = 0;
+        port->rx_len = n;
+    }
+    return (unsigned char)port->rx[port->rx_pos++];
+}
+
+static int pty_skip(char delim)
+{
+    at_pty_port* port = pty_port();
+    const char* p = memchr(port->rx + port->rx_pos, delim, port->rx_len - port->rx_pos);
+    int n = (p ? p - port->rx : port->rx_len) - port->rx_pos;
+
+    port->rx_pos += n;
+    return n;
+}
+
+static int pty_put(char c)
+{
+    at_pty_port* port = pty_port();
+
+    if (port->tx_len == (int)sizeof(port->tx))
+        pty_flush(port);
+    port->tx[port->tx_len++] = c;
+    return 0;
+}
+
+static int pty_readable()
+{
+    at_pty_port* port = pty_port();
+    struct pollfd pfd = { port->fd, POLLIN, 0 };
+
+    pty_flush(port);
+    return port->rx_pos < port->rx_len || poll(&pfd, 1, 0) > 0;
+}
+
+static int pty_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static void pty_delay(int ms)
+{
+    pty_flush(pty_port());
+    usleep(ms * 1000);
+}
+
+static uint32_t pty_tick(void)
+{
+    return at_emu_now_ns() / 1000000;
+}
+
+serial_ops at_pty_ops = { pty_get, pty_put, pty_readable, pty_init, pty_delay, pty_tick, pty_skip };
+
+void at_pty_port_init(at_pty_port* port, int fd)
+{
+    memset(port, 0, sizeof(*port));
+    port->fd = fd;
+}
@@ -0,0 +1,121 @@
+/**
+ ******************************************************************************
+ * @file    at_emu.h
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ */
+
+#ifndef _AT_EMU_H_
+#define _AT_EMU_H_
+
+#include "ATCmdParser.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/**
+ * Modem emulator behind a pty, answers:
+ *   AT, ATE0                    OK
+ *   AT+CSQ                      +CSQ: 23,99 / OK
+ *   AT+QIRD=<id>,<len>          +QIRD: <len> / <len printable bytes> / OK
+ * anything else with ERROR, and emits "+QIURC: \"recv\",0,<ns>" noise where
+ * <ns> is the CLOCK_MONOTONIC send time.
+ * Faults are drawn per command, rates in parts per million
+ */
+typedef struct {
+    int urc_interval_us;        /* 0: no URC noise */
+    int response_delay_us;      /* extra modem think time per command */
+    int urc_burst;              /* URCs per interval, 0 counts as 1 */
+    int drop_ppm;               /* command gets no answer */
+    int garbage_ppm;            /* binary garbage line before the answer */
+    int stall_ppm;              /* modem stalls before the answer */
+    int stall_us;
+    unsigned seed;
+} at_emu_config;
+
+typedef struct at_emu at_emu;
+
+/**
+ * Host side of a pty, used through at_pty_ops with the port as parser priv
+ */
+typedef struct {
+    int fd;
+    int rx_len;
+    int rx_pos;
+    int tx_len;
+    char rx[4096];
+    char tx[4096];
+} at_pty_port;
+
+/******************************************************************************
+ *                             Function Declarations
+ ******************************************************************************/
+
+at_emu *at_emu_start(const at_emu_config* cfg);
+
+/**
+ * @brief Emulator without pty or thread, driven through #at_emu_answer and
+ *        #at_emu_urcs by an in-memory port
+ */
+at_emu *at_emu_open(const at_emu_config* cfg);
+
+/**
+ * @brief Answer of one command line, stalls in the caller
+ *
+ * @return bytes written to out, at least AT_BUFFER_SIZE * 4 bytes
+ */
+int at_emu_answer(at_emu* emu, const char* cmd, char* out);
+
+/**
+ * @brief URCs due by now, out as for #at_emu_answer
+ *
+ * @return bytes written to out
+ */
+int at_emu_urcs(at_emu* emu, uint64_t now, char* out);
+
+/**
+ * @brief Time of the next URC, UINT64_MAX without URC noise
+ */
+uint64_t at_emu_next_urc(at_emu* emu);
+
+/**
+ * @brief Host side tty of the emulator, raw mode
+ */
+int at_emu_fd(at_emu* emu);
+
+/**
+ * @brief Stop the URC noise, e.g. to let a parser stuck behind a dropped
+ *        answer time out
+ */
+void at_emu_quiet(at_emu* emu);
+
+/**
+ * @brief Stop and free an emulator of #at_emu_start or #at_emu_open
+ */
+void at_emu_stop(at_emu* emu);
+
+uint64_t at_emu_now_ns(void);
+
+/**
+ * serial_ops over at_pty_port, writes are batched until the next read
+ */
+extern serial_ops at_pty_ops;
+
+void at_pty_port_init(at_pty_port* port, int fd);
+
+#endif //_AT_EMU_H_
@@ -0,0 +1,295 @@
+/**
+ ******************************************************************************
+ * @file    at_fuzz.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Fuzz target for the receive paths: the input is what the modem sends, fed
+ * through an in-memory port to recv, getline, process_oob and analyse_args.
+ * The first byte picks the matcher and the garbage filter. Besides crashes it
+ * catches slow paths: each pass has a CPU budget per byte, in multiples of
+ * getline's cost on plain traffic measured at start-up, and an input of
+ * FUZZ_TIMED_MIN bytes or more that overruns one aborts. A rescan or memmove
+ * per byte costs hundreds of units there, the linear passes a few.
+ * AT_FUZZ_NS_PER_BYTE in the environment replaces the measured unit.
+ *
+ * Build: clang -O1 -g -fsanitize=fuzzer,address -I. tools/at_fuzz.c ATCmdParser.c -o at_fuzz
+ *        cc -O2 -DAT_FUZZ_STANDALONE -I. tools/at_fuzz.c ATCmdParser.c -o at_fuzz
+ * Usage: at_fuzz -max_len=65536 [corpus_dir] [libFuzzer options]
+ *        at_fuzz [file ...]    standalone: run the files, or random inputs if none
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ATCmdParser.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define FUZZ_MAX_INPUT		(65536)
+#define FUZZ_TIMED_MIN		(10240)		/* shorter inputs are mostly setup and clock noise */
+#define FUZZ_CALIBRATE		(65536)		/* bytes of plain traffic timing the unit */
+#define FUZZ_RANDOM_RUNS	(5000)
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static const uint8_t* rx;
+static const uint8_t* rx_end;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static int mem_get(int timeout)
+{
+    (void)timeout;
+    return rx < rx_end ? *rx++ : -1;
+}
+
+static int mem_put(char c)
+{
+    (void)c;
+    return 0;
+}
+
+static int mem_readable()
+{
+    return rx < rx_end;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static int mem_skip(char delim)
+{
+    const uint8_t* p = rx;
+
+    while (p < rx_end && *p != (uint8_t)delim)
+        p++;
+    int n = p - rx;
+    rx = p;
+    return n;
+}
+
+static void urc_cb(void* arg)
+{
+    char line[64];
+    ATCmdParser_getline(arg, line, sizeof(line));
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// One timed pass over the whole input
+typedef struct {
+    const char* name;
+    uint32_t units;		/* budget per byte, in units of getline on plain traffic */
+} fuzz_pass;
+
+enum { PASS_CSQ, PASS_CREG, PASS_QIRD, PASS_QIRD_TAIL, PASS_STRING, PASS_GETLINE, PASS_OOB, PASS_ARGS, PASSES };
+
+// Matching on every byte in shadow mode runs both engines and reads the
+// clock twice, about eight units on lines that stay undecided
+static const fuzz_pass passes[PASSES] = {
+    [PASS_CSQ] = { "recv +CSQ", 4 },
+    [PASS_CREG] = { "recv +CREG", 4 },
+    [PASS_QIRD] = { "recv +QIRD", 4 },
+    [PASS_QIRD_TAIL] = { "recv +QIRD: %d", 20 },
+    [PASS_STRING] = { "recv %s", 4 },
+    [PASS_GETLINE] = { "getline", 4 },
+    [PASS_OOB] = { "process_oob", 4 },
+    [PASS_ARGS] = { "analyse_args", 2 },
+};
+
+static uint64_t pass_ns[PASSES];
+
+static void pass_run(ATParser* at, int pass, const uint8_t* data, size_t size)
+{
+    char* list[64];
+    char s[64];
+    int a, b;
+    unsigned x, y;
+    char* args;
+
+    rx = data;
+    rx_end = data + size;
+    uint64_t t = cpu_ns();
+    switch (pass) {
+    case PASS_CSQ:
+        ATCmdParser_recv(at, "+CSQ: %d,%d\r\nOK", &a, &b);
+        break;
+    case PASS_CREG:
+        ATCmdParser_recv(at, "+CREG: %d,%d,\"%x\",\"%x\"\n", &a, &b, &x, &y);
+        break;
+    case PASS_QIRD:
+        // Each line is scanned into the arguments from the first one on
+        ATCmdParser_recv(at, "+QIRD: %d\r\n%*[^\r]\r\nOK", &a);
+        break;
+    // Formats ending in a conversion are matched on every byte
+    case PASS_QIRD_TAIL:
+        ATCmdParser_recv(at, "+QIRD: %d", &a);
+        break;
+    case PASS_STRING:
+        ATCmdParser_recv(at, "%63s", s);
+        break;
+    case PASS_GETLINE:
+        while (ATCmdParser_getline(at, s, sizeof(s)) >= 0)
+            ;
+        break;
+    case PASS_OOB:
+        while (ATCmdParser_process_oob(at))
+            ;
+        break;
+    case PASS_ARGS:
+        args = malloc(size + 1);
+        if (!args)
+            break;
+        memcpy(args, data, size);
+        args[size] = 0;
+        ATCmdParser_analyse_args(at, args, list, 64);
+        free(args);
+        break;
+    }
+    pass_ns[pass] = cpu_ns() - t;
+}
+
+static void fuzz_input(const uint8_t* data, size_t size)
+{
+    static serial_ops ops = { .get = mem_get, .put = mem_put, .readable = mem_readable, .init = mem_init, .skip = mem_skip };
+    static ATParser parser;
+    static struct oob urc_node;
+    uint8_t flags = size ? data[0] : 0;
+
+    ATCmdParser_init_static(&parser, &ops, "\r", "\r\n", 10, false);
+    ATCmdParser_add_oob_static(&parser, &urc_node, "+QIURC:", urc_cb);
+    ATCmdParser_set_matcher(&parser, (at_matcher)(flags % 3));
+    if (flags & 4)
+        ATCmdParser_set_garbage_filter(&parser, 256, AT_GARBAGE_BINARY);
+
+    // The rest is the modem's output
+    for (int pass = 0; pass < PASSES; pass++)
+        pass_run(&parser, pass, data + 1, size ? size - 1 : 0);
+}
+
+// Picoseconds per byte of getline on plain traffic, the best of three runs
+static uint64_t calibrate(void)
+{
+    static const char line[] = "+CSQ: 20,99\r\nOK\r\n";
+    static uint8_t ref[FUZZ_CALIBRATE];
+    uint64_t best = UINT64_MAX;
+
+    ref[0] = AT_MATCHER_FAST;
+    for (size_t k = 1; k < sizeof(ref); k++)
+        ref[k] = line[(k - 1) % (sizeof(line) - 1)];
+    for (int run = 0; run < 3; run++) {
+        fuzz_input(ref, sizeof(ref));
+        if (pass_ns[PASS_GETLINE] < best)
+            best = pass_ns[PASS_GETLINE];
+    }
+    return best * 1000 / sizeof(ref) + 1;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static uint64_t unit_ps;
+
+    if (!unit_ps) {
+        const char* env = getenv("AT_FUZZ_NS_PER_BYTE");
+        unit_ps = env && atoi(env) > 0 ? (uint64_t)atoi(env) * 1000 : calibrate();
+    }
+    if (size > FUZZ_MAX_INPUT)
+        return 0;
+
+    fuzz_input(data, size);
+    if (size < FUZZ_TIMED_MIN)
+        return 0;
+    for (int pass = 0; pass < PASSES; pass++) {
+        uint64_t budget = passes[pass].units * unit_ps * size / 1000;
+        if (pass_ns[pass] > budget) {
+            fprintf(stderr, "at_fuzz: %s took %.1f ns/byte on %zu bytes, budget %.1f\n", passes[pass].name,
+                    (double)pass_ns[pass] / size, size, (double)budget / size);
+            abort();
+        }
+    }
+    return 0;
+}
+
+#ifdef AT_FUZZ_STANDALONE
+// Random inputs built from protocol fragments, so lines get past the prefixes
+static size_t random_input(uint8_t* buf, size_t cap)
+{
+    static const char* frags[] = {
+        "\r\n", "OK", "ERROR", "+CSQ: ", "+CREG: ", "+QIRD: ", "+QIURC: ", "\"recv\",",
+        "0", "12", "99", ",", "\\,", "\"", "%", " ", "\t", "x", "\x01\x02", "\xff", ":",
+    };
+    // One in eight is long enough to be timed
+    size_t len = rand() % 8 ? (size_t)(1 + rand() % 1024) : FUZZ_TIMED_MIN + rand() % (cap - FUZZ_TIMED_MIN);
+    size_t n = 0;
+
+    buf[n++] = rand();
+    while (n < len) {
+        const char* f = frags[rand() % (sizeof(frags) / sizeof(frags[0]))];
+        // Some fragments repeat to grow long lines
+        int times = rand() % 8 == 0 ? rand() % 2000 : 1;
+        for (int k = 0; k < times; k++) {
+            for (const char* p = f; *p && n < len; p++)
+                buf[n++] = *p;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t buf[FUZZ_MAX_INPUT];
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            FILE* f = fopen(argv[i], "rb");
+            if (!f) {
+                perror(argv[i]);
+                return 1;
+            }
+            size_t n = fread(buf, 1, sizeof(buf), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(buf, n);
+        }
+        printf("%d inputs passed\n", argc - 1);
+        return 0;
+    }
+
+    srand(1);
+    for (int i = 0; i < FUZZ_RANDOM_RUNS; i++)
+        LLVMFuzzerTestOneInput(buf, random_input(buf, sizeof(buf)));
+    printf("%d random inputs passed\n", FUZZ_RANDOM_RUNS);
+    return 0;
+}
+#endif
@@ -0,0 +1,603 @@
+/**
+ ******************************************************************************
+ * @file    at_loadgen.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * Gateway-scale load generator: drives many parsers, one thread per device,
+ * against emulated modems behind ptys or in memory, from a workload
+ * description, and reports throughput, latency percentiles per command, CPU
+ * per device and memory per device.
+ *
+ * A workload is a list of "key value" lines, '#' starts a comment, the same
+ * pairs can be given as key=value arguments after the file:
+ *   devices 64                 emulated modems
+ *   duration 10                seconds, or
+ *   commands 10000             per device
+ *   rate 100                   commands/s per device, 0: back to back; latency
+ *                              is taken from the scheduled start
+ *   mix at:10,csq:60,qird:30   command weights, qird is a socket read
+ *   payload 512                qird bytes
+ *   timeout 1000               parser timeout, ms
+ *   urc_interval 2000          us between URC bursts, 0: none
+ *   urc_burst 1                URCs per burst
+ *   response_delay 0           modem think time, us
+ *   drop 0 / garbage 0 / stall 0   fault rates per command, ppm; with URC noise a
+ *                              dropped answer holds its device until the run ends
+ *   stall_us 200000
+ *   transport pty|mem
+ *   backend thread|epoll|uring ptys served by each device thread or an ATCmdLoop
+ *   seed 1
+ *
+ * Build: cc -O2 -DATCMDLOOP_IO_URING -I. tools/at_loadgen.c tools/at_emu.c ATCmdParser.c \
+ *            ATCmdLoop.c ATCmdTimer.c -lpthread -o at_loadgen
+ * Usage: at_loadgen [workload] [key=value ...]
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ATCmdLoop.h"
+#include "at_emu.h"
+
+/******************************************************************************
+ *                                 Constants
+ ******************************************************************************/
+
+#define MEM_RX_SIZE		(AT_BUFFER_SIZE * 8)
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+typedef enum {
+    CMD_AT = 0,
+    CMD_CSQ,
+    CMD_QIRD,
+    CMD_KINDS,
+} cmd_kind;
+
+typedef struct {
+    int devices;
+    int duration;
+    int commands;
+    int rate;
+    int weights[CMD_KINDS];
+    int payload;
+    int timeout;
+    at_emu_config emu;
+    char transport[8];
+    char backend[8];
+} workload;
+
+typedef struct {
+    uint64_t* v;
+    int n;
+    int cap;
+} samples;
+
+/* The pty port comes first so the parser priv serves at_pty_ops as well,
+   with a loop the priv is loop_dev and its user points back here */
+typedef struct {
+    at_pty_port port;
+    at_loop_dev loop_dev;
+    at_emu* emu;
+    ATParser* at;
+    const workload* w;
+    unsigned seed;
+    int ok;
+    int failed;
+    uint64_t bytes;
+    uint64_t cpu_ns;
+    samples lat[CMD_KINDS];
+    samples urc;
+    int mem_len;
+    int mem_pos;
+    int mem_line_len;
+    char mem_line[256];
+    char mem_rx[MEM_RX_SIZE];
+} load_dev;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static const char* const kind_names[CMD_KINDS] = { "at", "csq", "qird" };
+
+static at_loop* loop;
+static uint64_t deadline;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static load_dev* dev_of(ATParser *at)
+{
+    void* priv = ATCmdParser_priv(at);
+    return loop ? ((at_loop_dev*)priv)->user : priv;
+}
+
+static void sample_add(samples* s, uint64_t v)
+{
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+    }
+    s->v[s->n++] = v;
+}
+
+static void sample_merge(samples* to, const samples* from)
+{
+    for (int i = 0; i < from->n; i++)
+        sample_add(to, from->v[i]);
+}
+
+/* In-memory transport, the emulator answers inside put */
+
+static void mem_append(load_dev* dev, int (*fill)(load_dev*, char*))
+{
+    if (dev->mem_pos == dev->mem_len) {
+        dev->mem_pos = 0;
+        dev->mem_len = 0;
+    } else if (dev->mem_len > MEM_RX_SIZE - AT_BUFFER_SIZE * 4) {
+        memmove(dev->mem_rx, dev->mem_rx + dev->mem_pos, dev->mem_len - dev->mem_pos);
+        dev->mem_len -= dev->mem_pos;
+        dev->mem_pos = 0;
+    }
+    if (dev->mem_len <= MEM_RX_SIZE - AT_BUFFER_SIZE * 4)
+        dev->mem_len += fill(dev, dev->mem_rx + dev->mem_len);
+}
+
+static int mem_fill_urcs(load_dev* dev, char* out)
+{
+    return at_emu_urcs(dev->emu, at_emu_now_ns(), out);
+}
+
+static int mem_fill_answer(load_dev* dev, char* out)
+{
+    return at_emu_answer(dev->emu, dev->mem_line, out);
+}
+
+static int mem_get(int timeout)
+{
+    load_dev* dev = dev_of(ATCmdParser_current());
+
+    if (dev->mem_pos == dev->mem_len)
+        mem_append(dev, mem_fill_urcs);
+    if (dev->mem_pos == dev->mem_len) {
+        // Nothing else can arrive before the next URC
+        uint64_t now = at_emu_now_ns();
+        uint64_t until = now + timeout * 1000000ull;
+        uint64_t urc = at_emu_next_urc(dev->emu);
+        if (urc > until) {
+            if (timeout > 0)
+                usleep(timeout * 1000);
+            return -1;
+        }
+        if (urc > now)
+            usleep((urc - now) / 1000);
+        mem_append(dev, mem_fill_urcs);
+        if (dev->mem_pos == dev->mem_len)
+            return -1;
+    }
+    return (unsigned char)dev->mem_rx[dev->mem_pos++];
+}
+
+static int mem_put(char c)
+{
+    load_dev* dev = dev_of(ATCmdParser_current());
+
+    if (c == '\r' || c == '\n') {
+        if (dev->mem_line_len) {
+            dev->mem_line[dev->mem_line_len] = 0;
+            mem_append(dev, mem_fill_answer);
+            dev->mem_line_len = 0;
+        }
+    } else if (dev->mem_line_len + 1 < (int)sizeof(dev->mem_line)) {
+        dev->mem_line[dev->mem_line_len++] = c;
+    }
+    return 0;
+}
+
+static int mem_readable()
+{
+    load_dev* dev = dev_of(ATCmdParser_current());
+
+    if (dev->mem_pos == dev->mem_len)
+        mem_append(dev, mem_fill_urcs);
+    return dev->mem_pos < dev->mem_len;
+}
+
+static int mem_init(int timeout)
+{
+    (void)timeout;
+    return 0;
+}
+
+static void mem_delay(int ms)
+{
+    usleep(ms * 1000);
+}
+
+static uint32_t mem_tick(void)
+{
+    return at_emu_now_ns() / 1000000;
+}
+
+static int mem_skip(char delim)
+{
+    load_dev* dev = dev_of(ATCmdParser_current());
+    const char* p = memchr(dev->mem_rx + dev->mem_pos, delim, dev->mem_len - dev->mem_pos);
+    int n = (p ? p - dev->mem_rx : dev->mem_len) - dev->mem_pos;
+
+    dev->mem_pos += n;
+    return n;
+}
+
+static serial_ops mem_ops = { mem_get, mem_put, mem_readable, mem_init, mem_delay, mem_tick, mem_skip };
+
+static void urc_cb(void* arg)
+{
+    ATParser *at = arg;
+    load_dev* dev = dev_of(at);
+    unsigned long long sent;
+    char line[64];
+
+    // Rest of "+QIURC: \"recv\",0,<ns>"
+    if (ATCmdParser_getline(at, line, sizeof(line)) < 0)
+        return;
+    if (sscanf(line, " \"recv\",0,%llu", &sent) == 1)
+        sample_add(&dev->urc, at_emu_now_ns() - sent);
+}
+
+static cmd_kind pick(load_dev* dev)
+{
+    const int* weights = dev->w->weights;
+    int total = 0;
+
+    for (int k = 0; k < CMD_KINDS; k++)
+        total += weights[k];
+    int r = rand_r(&dev->seed) % total;
+    for (int k = 0; k < CMD_KINDS; k++) {
+        if (r < weights[k])
+            return k;
+        r -= weights[k];
+    }
+    return CMD_AT;
+}
+
+static bool run_command(load_dev* dev, cmd_kind kind, char* line)
+{
+    bool sent;
+    int n;
+
+    switch (kind) {
+    case CMD_CSQ: sent = ATCmdParser_send(dev->at, "AT+CSQ"); break;
+    case CMD_QIRD: sent = ATCmdParser_send(dev->at, "AT+QIRD=0,%d", dev->w->payload); break;
+    default: sent = ATCmdParser_send(dev->at, "AT"); break;
+    }
+    if (!sent)
+        return false;
+    while ((n = ATCmdParser_getline(dev->at, line, AT_BUFFER_SIZE)) >= 0) {
+        dev->bytes += n;
+        if (strcmp(line, "OK") == 0)
+            return true;
+        if (strcmp(line, "ERROR") == 0)
+            return false;
+    }
+    return false;
+}
+
+static void* load_thread(void* arg)
+{
+    load_dev* dev = arg;
+    const workload* w = dev->w;
+    char* line = malloc(AT_BUFFER_SIZE);
+    uint64_t start = at_emu_now_ns();
+    struct timespec cpu;
+
+    for (int i = 0; !w->commands || i < w->commands; i++) {
+        uint64_t t = at_emu_now_ns();
+        if (deadline && t >= deadline)
+            break;
+        // Open loop: a late command is charged the time it waited
+        if (w->rate) {
+            uint64_t due = start + i * 1000000000ull / w->rate;
+            if (due > t)
+                usleep((due - t) / 1000);
+            t = due;
+        }
+
+        cmd_kind kind = pick(dev);
+        if (loop)
+            ATCmdLoop_lock(&dev->loop_dev);
+        bool ok = run_command(dev, kind, line);
+        if (loop)
+            ATCmdLoop_unlock(&dev->loop_dev);
+        if (ok) {
+            dev->ok++;
+            sample_add(&dev->lat[kind], at_emu_now_ns() - t);
+        } else {
+            dev->failed++;
+        }
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    dev->cpu_ns = cpu.tv_sec * 1000000000ull + cpu.tv_nsec;
+    free(line);
+    return NULL;
+}
+
+static bool workload_set(workload* w, const char* key, const char* value)
+{
+    int v = atoi(value);
+
+    if (strcmp(key, "devices") == 0) w->devices = v;
+    else if (strcmp(key, "duration") == 0) w->duration = v;
+    else if (strcmp(key, "commands") == 0) w->commands = v;
+    else if (strcmp(key, "rate") == 0) w->rate = v;
+    else if (strcmp(key, "payload") == 0) w->payload = v;
+    else if (strcmp(key, "timeout") == 0) w->timeout = v;
+    else if (strcmp(key, "urc_interval") == 0) w->emu.urc_interval_us = v;
+    else if (strcmp(key, "urc_burst") == 0) w->emu.urc_burst = v;
+    else if (strcmp(key, "response_delay") == 0) w->emu.response_delay_us = v;
+    else if (strcmp(key, "drop") == 0) w->emu.drop_ppm = v;
+    else if (strcmp(key, "garbage") == 0) w->emu.garbage_ppm = v;
+    else if (strcmp(key, "stall") == 0) w->emu.stall_ppm = v;
+    else if (strcmp(key, "stall_us") == 0) w->emu.stall_us = v;
+    else if (strcmp(key, "seed") == 0) w->emu.seed = v;
+    else if (strcmp(key, "transport") == 0) snprintf(w->transport, sizeof(w->transport), "%s", value);
+    else if (strcmp(key, "backend") == 0) snprintf(w->backend, sizeof(w->backend), "%s", value);
+    else if (strcmp(key, "mix") == 0) {
+        memset(w->weights, 0, sizeof(w->weights));
+        for (const char* p = value; *p; ) {
+            int k = 0;
+            while (k < CMD_KINDS && strncmp(p, kind_names[k], strlen(kind_names[k])) != 0)
+                k++;
+            const char* colon = strchr(p, ':');
+            if (k == CMD_KINDS || !colon)
+                return false;
+            w->weights[k] = atoi(colon + 1);
+            p = strchr(p, ',');
+            if (!p)
+                break;
+            p++;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// "key value" or "key=value", comments and blank lines ignored
+static bool workload_line(workload* w, char* line)
+{
+    char* hash = strchr(line, '#');
+    if (hash)
+        *hash = 0;
+    char* key = line;
+    while (isspace((unsigned char)*key))
+        key++;
+    if (!*key)
+        return true;
+    char* value = key;
+    while (*value && !isspace((unsigned char)*value) && *value != '=')
+        value++;
+    if (*value)
+        *value++ = 0;
+    while (isspace((unsigned char)*value) || *value == '=')
+        value++;
+    char* end = value + strlen(value);
+    while (end > value && isspace((unsigned char)end[-1]))
+        *--end = 0;
+    if (workload_set(w, key, value))
+        return true;
+    fprintf(stderr, "bad workload entry: %s %s\n", key, value);
+    return false;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char* name, samples* s)
+{
+    uint64_t* v = s->v;
+    int n = s->n;
+
+    if (n == 0) {
+        printf("%-8s n=0\n", name);
+        return;
+    }
+    qsort(v, n, sizeof(*v), cmp_u64);
+    printf("%-8s n=%-9d p50=%9.1fus p90=%9.1fus p99=%9.1fus p99.9=%9.1fus max=%9.1fus\n", name, n,
+           v[n / 2] / 1e3, v[(int)(n * 0.9)] / 1e3, v[(int)(n * 0.99)] / 1e3, v[(int)(n * 0.999)] / 1e3, v[n - 1] / 1e3);
+}
+
+static long rss_kib(void)
+{
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+
+    if (!f)
+        return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char* argv[])
+{
+    workload w = { .devices = 1, .duration = 5, .weights = { 10, 60, 30 }, .payload = 256,
+                   .timeout = 1000, .emu = { .stall_us = 200000, .seed = 1 },
+                   .transport = "pty", .backend = "thread" };
+    int arg = 1;
+
+    if (arg < argc && !strchr(argv[arg], '=')) {
+        FILE* f = fopen(argv[arg], "r");
+        char line[256];
+        if (!f) {
+            perror(argv[arg]);
+            return 2;
+        }
+        while (fgets(line, sizeof(line), f)) {
+            if (!workload_line(&w, line))
+                return 2;
+        }
+        fclose(f);
+        arg++;
+    }
+    for (; arg < argc; arg++) {
+        if (!workload_line(&w, argv[arg])) {
+            fprintf(stderr, "usage: %s [workload] [key=value ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (w.commands)
+        w.duration = 0;
+
+    bool mem = strcmp(w.transport, "mem") == 0;
+    if (w.devices < 1 || w.payload + 64 > AT_BUFFER_SIZE
+            || w.weights[CMD_AT] + w.weights[CMD_CSQ] + w.weights[CMD_QIRD] <= 0) {
+        fprintf(stderr, "need devices, a command mix and a payload fitting a %d byte line\n", AT_BUFFER_SIZE);
+        return 2;
+    }
+    if (strcmp(w.backend, "thread") != 0) {
+        if (mem) {
+            fprintf(stderr, "the %s backend needs the pty transport\n", w.backend);
+            return 2;
+        }
+        loop = ATCmdLoop_create_backend(0, strcmp(w.backend, "uring") == 0 ? AT_LOOP_IO_URING : AT_LOOP_EPOLL);
+        if (!loop) {
+            fprintf(stderr, "%s backend not available\n", w.backend);
+            return 1;
+        }
+    }
+
+    load_dev* devs = calloc(w.devices, sizeof(load_dev));
+    pthread_t* threads = calloc(w.devices, sizeof(pthread_t));
+    for (int d = 0; d < w.devices; d++) {
+        at_emu_config cfg = w.emu;
+        cfg.seed = w.emu.seed + d;
+        devs[d].emu = mem ? at_emu_open(&cfg) : at_emu_start(&cfg);
+        if (!devs[d].emu) {
+            perror("pty");
+            return 1;
+        }
+    }
+
+    // Host side cost only: the emulators already exist
+    long rss_base = rss_kib();
+    for (int d = 0; d < w.devices; d++) {
+        load_dev* dev = &devs[d];
+        dev->w = &w;
+        dev->seed = w.emu.seed * 7919 + d;
+        if (loop) {
+            dev->at = ATCmdParser_init(&at_loop_ops, "\r", "\r\n", w.timeout, false);
+            dev->loop_dev.user = dev;
+            ATCmdLoop_add(loop, &dev->loop_dev, at_emu_fd(dev->emu), dev->at);
+        } else {
+            at_pty_port_init(&dev->port, mem ? -1 : at_emu_fd(dev->emu));
+            dev->at = ATCmdParser_init(mem ? &mem_ops : &at_pty_ops, "\r", "\r\n", w.timeout, false);
+            ATCmdParser_set_priv(dev->at, dev);
+        }
+        ATCmdParser_set_timeout(dev->at, w.timeout);
+        ATCmdParser_set_garbage_filter(dev->at, 0, AT_GARBAGE_BINARY);
+        ATCmdParser_add_oob(dev->at, "+QIURC:", urc_cb);
+    }
+    long rss_setup = rss_kib() - rss_base;
+
+    uint64_t start = at_emu_now_ns();
+    if (w.duration)
+        deadline = start + w.duration * 1000000000ull;
+    for (int d = 0; d < w.devices; d++)
+        pthread_create(&threads[d], NULL, load_thread, &devs[d]);
+    if (deadline) {
+        // URCs reset the parser's per-character timeout, so a device waiting on
+        // a dropped answer only gets its timeout once the noise stops
+        usleep(w.duration * 1000000ull);
+        for (int d = 0; d < w.devices; d++)
+            at_emu_quiet(devs[d].emu);
+    }
+    for (int d = 0; d < w.devices; d++)
+        pthread_join(threads[d], NULL);
+    double secs = (at_emu_now_ns() - start) / 1e9;
+
+    samples all = { 0 }, by_kind[CMD_KINDS] = { { 0 } }, urc = { 0 };
+    int ok = 0, failed = 0;
+    uint64_t bytes = 0, cpu_sum = 0, cpu_max = 0;
+    ATParserStats totals = { 0 };
+    for (int d = 0; d < w.devices; d++) {
+        load_dev* dev = &devs[d];
+        ATParserStats st;
+        ok += dev->ok;
+        failed += dev->failed;
+        bytes += dev->bytes;
+        cpu_sum += dev->cpu_ns;
+        if (dev->cpu_ns > cpu_max)
+            cpu_max = dev->cpu_ns;
+        for (int k = 0; k < CMD_KINDS; k++) {
+            sample_merge(&all, &dev->lat[k]);
+            sample_merge(&by_kind[k], &dev->lat[k]);
+        }
+        sample_merge(&urc, &dev->urc);
+        ATCmdParser_get_stats(dev->at, &st);
+        totals.timeouts += st.timeouts;
+        totals.garbage_lines += st.garbage_lines;
+        totals.restarts += st.restarts;
+        totals.rx_bytes += st.rx_bytes;
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double proc_cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+    printf("workload devices=%d transport=%s backend=%s %s=%d rate=%d mix=at:%d,csq:%d,qird:%d payload=%d\n",
+           w.devices, w.transport, w.backend, w.commands ? "commands" : "duration", w.commands ? w.commands : w.duration,
+           w.rate, w.weights[CMD_AT], w.weights[CMD_CSQ], w.weights[CMD_QIRD], w.payload);
+    printf("modem    urc_interval=%dus burst=%d drop=%dppm garbage=%dppm stall=%dppm/%dus\n",
+           w.emu.urc_interval_us, w.emu.urc_burst, w.emu.drop_ppm, w.emu.garbage_ppm, w.emu.stall_ppm, w.emu.stall_us);
+    printf("throughput %.0f cmd/s, %.2f MB/s received, %d failed, %u timeouts, %u garbage lines, %u restarts\n",
+           ok / secs, totals.rx_bytes / secs / 1e6, failed, totals.timeouts, totals.garbage_lines, totals.restarts);
+    report("all", &all);
+    for (int k = 0; k < CMD_KINDS; k++) {
+        if (w.weights[k])
+            report(kind_names[k], &by_kind[k]);
+    }
+    report("urc", &urc);
+    printf("cpu      process %.2fs (%.2f cores, emulators included), device thread avg %.1fms max %.1fms (%.2f%% of a core)\n",
+           proc_cpu, proc_cpu / secs,
+           cpu_sum / 1e6 / w.devices, cpu_max / 1e6, cpu_sum / 1e7 / w.devices / secs);
+    size_t port = loop ? sizeof(at_loop_dev) : mem ? MEM_RX_SIZE : sizeof(at_pty_port);
+    printf("memory   parser %zu B + port %zu B per device, RSS +%.1f KiB/device after setup, peak RSS %.1f MiB\n",
+           sizeof(ATParser), port, (double)rss_setup / w.devices, ru.ru_maxrss / 1024.0);
+
+    if (loop) {
+        for (int d = 0; d < w.devices; d++)
+            ATCmdLoop_remove(loop, &devs[d].loop_dev);
+        ATCmdLoop_destroy(loop);
+    }
+    for (int d = 0; d < w.devices; d++)
+        at_emu_stop(devs[d].emu);
+    return 0;
+}
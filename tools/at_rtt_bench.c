@@ -0,0 +1,242 @@
+/**
+ ******************************************************************************
+ * @file    at_rtt_bench.c
+ ******************************************************************************
+ *
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************
+ *
+ * End-to-end command round trip benchmark against the pty modem emulator,
+ * one thread per device so scheduling and syscall costs are included.
+ * With -b the ports are served by an ATCmdLoop instead of each thread
+ * polling its own, and syscalls per byte of the loop backend are reported.
+ *
+ * Build: cc -O2 -DATCMDLOOP_IO_URING -I. tools/at_rtt_bench.c tools/at_emu.c ATCmdParser.c \
+ *            ATCmdLoop.c ATCmdTimer.c -lpthread -o at_rtt_bench
+ * Usage: at_rtt_bench [-d devices] [-n commands] [-p payload] [-u urc_interval_us] [-b epoll|uring]
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ATCmdLoop.h"
+#include "at_emu.h"
+
+/******************************************************************************
+ *                               Type Definitions
+ ******************************************************************************/
+
+/* The port comes first so the parser priv serves both at_pty_ops and us,
+   with a loop the priv is loop_dev and its user points back here */
+typedef struct {
+    at_pty_port port;
+    at_loop_dev loop_dev;
+    at_emu* emu;
+    ATParser* at;
+    int commands;
+    int payload;
+    int failed;
+    int rtt_count;
+    int urc_count;
+    uint64_t bytes;
+    uint64_t* rtt;
+    uint64_t* urc;
+    int urc_cap;
+} bench_dev;
+
+/******************************************************************************
+ *                              Variable Definitions
+ ******************************************************************************/
+
+static at_loop* loop;
+
+/******************************************************************************
+ *                              Function Definitions
+ ******************************************************************************/
+
+static bench_dev* bench_of(ATParser *at)
+{
+    void* priv = ATCmdParser_priv(at);
+    return loop ? ((at_loop_dev*)priv)->user : priv;
+}
+
+static void urc_cb(void* arg)
+{
+    ATParser *at = arg;
+    bench_dev* dev = bench_of(at);
+    unsigned long long sent;
+    char line[64];
+
+    // Rest of "+QIURC: \"recv\",0,<ns>"
+    if (ATCmdParser_getline(at, line, sizeof(line)) < 0)
+        return;
+    if (sscanf(line, " \"recv\",0,%llu", &sent) == 1 && dev->urc_count < dev->urc_cap)
+        dev->urc[dev->urc_count++] = at_emu_now_ns() - sent;
+}
+
+static void* bench_thread(void* arg)
+{
+    bench_dev* dev = arg;
+    char* line = malloc(AT_BUFFER_SIZE);
+
+    for (int i = 0; i < dev->commands; i++) {
+        uint64_t t = at_emu_now_ns();
+        bool ok = false;
+        int n;
+
+        if (loop)
+            ATCmdLoop_lock(&dev->loop_dev);
+        if (!ATCmdParser_send(dev->at, "AT+QIRD=0,%d", dev->payload))
+            n = -1;
+        else while ((n = ATCmdParser_getline(dev->at, line, AT_BUFFER_SIZE)) >= 0) {
+            dev->bytes += n;
+            if (strcmp(line, "OK") == 0) {
+                ok = true;
+                break;
+            }
+            if (strcmp(line, "ERROR") == 0)
+                break;
+        }
+        if (loop)
+            ATCmdLoop_unlock(&dev->loop_dev);
+        if (ok)
+            dev->rtt[dev->rtt_count++] = at_emu_now_ns() - t;
+        else
+            dev->failed++;
+    }
+    free(line);
+    return NULL;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char* name, uint64_t* v, int n)
+{
+    if (n == 0) {
+        printf("%-8s n=0\n", name);
+        return;
+    }
+    qsort(v, n, sizeof(*v), cmp_u64);
+    printf("%-8s n=%-8d p50=%8.1fus p99=%8.1fus p99.9=%8.1fus max=%8.1fus\n", name, n,
+           v[n / 2] / 1e3, v[(int)(n * 0.99)] / 1e3, v[(int)(n * 0.999)] / 1e3, v[n - 1] / 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    int devices = 1, commands = 10000, payload = 64;
+    at_emu_config cfg = { 0 };
+    const char* backend = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:p:u:b:")) != -1) {
+        switch (opt) {
+        case 'd': devices = atoi(optarg); break;
+        case 'n': commands = atoi(optarg); break;
+        case 'p': payload = atoi(optarg); break;
+        case 'u': cfg.urc_interval_us = atoi(optarg); break;
+        case 'b': backend = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-d devices] [-n commands] [-p payload] [-u urc_interval_us] [-b epoll|uring]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (backend) {
+        loop = ATCmdLoop_create_backend(0, strcmp(backend, "uring") == 0 ? AT_LOOP_IO_URING : AT_LOOP_EPOLL);
+        if (!loop) {
+            fprintf(stderr, "%s backend not available\n", backend);
+            return 1;
+        }
+    }
+    if (payload + 64 > AT_BUFFER_SIZE) {
+        fprintf(stderr, "payload must fit a %d byte line\n", AT_BUFFER_SIZE);
+        return 2;
+    }
+
+    bench_dev* devs = calloc(devices, sizeof(bench_dev));
+    pthread_t* threads = calloc(devices, sizeof(pthread_t));
+    for (int d = 0; d < devices; d++) {
+        bench_dev* dev = &devs[d];
+        dev->emu = at_emu_start(&cfg);
+        if (!dev->emu) {
+            perror("pty");
+            return 1;
+        }
+        if (loop) {
+            dev->at = ATCmdParser_init(&at_loop_ops, "\r", "\r\n", 1000, false);
+            dev->loop_dev.user = dev;
+            ATCmdLoop_add(loop, &dev->loop_dev, at_emu_fd(dev->emu), dev->at);
+        } else {
+            at_pty_port_init(&dev->port, at_emu_fd(dev->emu));
+            dev->at = ATCmdParser_init(&at_pty_ops, "\r", "\r\n", 1000, false);
+            ATCmdParser_set_priv(dev->at, dev);
+        }
+        ATCmdParser_set_timeout(dev->at, 1000);
+        ATCmdParser_add_oob(dev->at, "+QIURC:", urc_cb);
+        dev->commands = commands;
+        dev->payload = payload;
+        dev->rtt = calloc(commands, sizeof(uint64_t));
+        dev->urc_cap = commands * 4 + 1024;
+        dev->urc = calloc(dev->urc_cap, sizeof(uint64_t));
+    }
+
+    uint64_t start = at_emu_now_ns();
+    for (int d = 0; d < devices; d++)
+        pthread_create(&threads[d], NULL, bench_thread, &devs[d]);
+    for (int d = 0; d < devices; d++)
+        pthread_join(threads[d], NULL);
+    double secs = (at_emu_now_ns() - start) / 1e9;
+
+    int total_rtt = 0, total_urc = 0, failed = 0;
+    uint64_t bytes = 0;
+    for (int d = 0; d < devices; d++) {
+        total_rtt += devs[d].rtt_count;
+        total_urc += devs[d].urc_count;
+        failed += devs[d].failed;
+        bytes += devs[d].bytes;
+    }
+    uint64_t* rtt = malloc((total_rtt + 1) * sizeof(uint64_t));
+    uint64_t* urc = malloc((total_urc + 1) * sizeof(uint64_t));
+    for (int d = 0, r = 0, u = 0; d < devices; d++) {
+        memcpy(rtt + r, devs[d].rtt, devs[d].rtt_count * sizeof(uint64_t));
+        memcpy(urc + u, devs[d].urc, devs[d].urc_count * sizeof(uint64_t));
+        r += devs[d].rtt_count;
+        u += devs[d].urc_count;
+    }
+
+    printf("devices=%d commands=%d payload=%d urc_interval=%dus failed=%d\n",
+           devices, commands, payload, cfg.urc_interval_us, failed);
+    printf("throughput %.0f cmd/s, %.2f MB/s payload\n", total_rtt / secs, bytes / secs / 1e6);
+    report("rtt", rtt, total_rtt);
+    report("urc", urc, total_urc);
+
+    if (loop) {
+        at_loop_stats st;
+        ATCmdLoop_get_stats(loop, &st);
+        printf("%s: %llu syscalls, %llu wakeups, %.4f syscalls/byte\n", backend,
+               (unsigned long long)st.syscalls, (unsigned long long)st.wakeups,
+               (double)st.syscalls / (st.rx_bytes + st.tx_bytes));
+        for (int d = 0; d < devices; d++)
+            ATCmdLoop_remove(loop, &devs[d].loop_dev);
+        ATCmdLoop_destroy(loop);
+    }
+    for (int d = 0; d < devices; d++)
+        at_emu_stop(devs[d].emu);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,465 @@
+#!/usr/bin/env python3
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Generate ATCmdParser bindings from a modem command-set description.
+
+Usage: atgen.py [--cpp] [-o OUTDIR] description.(json|yaml)
+
+For every command the generator emits a typed result struct and a function
+that sends the command from a pre-split send template, waits for the final result code and parses the
+response line with straight-line code instead of a runtime scanf format.
+URCs get typed structs, matchers and a dispatch table registered per parser
+through ATCmdParser_add_oob_arg. With --cpp a thin C++ wrapper class is
+emitted too.
+
+Description format (see modem_example.json):
+
+    name        module name, used as C identifier prefix
+    commands    list of {name, send, params, response, timeout}
+    urcs        list of {name, prefix, fields}
+
+params and fields are lists of {name, type[, size][, optional]} where type
+is one of int, uint, hex or string (size is the buffer size, default 32).
+Optional fields may be missing from the end of a line and read as 0 or "";
+only trailing fields can be optional. A response is {prefix, fields};
+without a prefix the echo of the command is skipped, without a response
+only the result code is checked.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+TYPES = {
+    'int':    ('int', '%d', 'at_gen_int'),
+    'uint':   ('unsigned', '%u', 'at_gen_uint'),
+    'hex':    ('unsigned', '%x', 'at_gen_hex'),
+    'string': ('char', '%s', 'at_gen_str'),
+}
+
+LICENSE = """/**
+ ******************************************************************************
+ * @file    {file}
+ ******************************************************************************
+ *
+ * Generated by tools/atgen.py from {src}, do not edit.
+ *
+ ******************************************************************************
+ */
+"""
+
+HELPERS = r"""#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+static inline bool at_gen_int(const char** p, int* out)
+{
+    const char* s = *p;
+    char* end;
+
+    if (*s == '-' || *s == '+')
+        s++;
+    if (*s < '0' || *s > '9')
+        return false;
+    errno = 0;
+    long v = strtol(*p, &end, 10);
+    if (errno == ERANGE || v < INT_MIN || v > INT_MAX)
+        return false;
+    *out = (int)v;
+    *p = end;
+    return true;
+}
+
+static inline bool at_gen_uint(const char** p, unsigned* out)
+{
+    const char* s = *p;
+    unsigned v = 0;
+
+    if (*s < '0' || *s > '9')
+        return false;
+    while (*s >= '0' && *s <= '9')
+        v = v * 10 + (*s++ - '0');
+    *out = v;
+    *p = s;
+    return true;
+}
+
+static inline bool at_gen_hex(const char** p, unsigned* out)
+{
+    const char* s = *p;
+    unsigned v = 0;
+    int n = 0;
+
+    if (*s == '"')
+        s++;
+    for (;; s++, n++) {
+        if (*s >= '0' && *s <= '9')
+            v = (v << 4) | (*s - '0');
+        else if ((*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+            v = (v << 4) | ((*s | 0x20) - 'a' + 10);
+        else
+            break;
+    }
+    if (n == 0)
+        return false;
+    if (*s == '"')
+        s++;
+    *out = v;
+    *p = s;
+    return true;
+}
+
+static inline bool at_gen_str(const char** p, char* out, int size)
+{
+    const char* s = *p;
+    char end = ',';
+    int n = 0;
+
+    if (*s == '"') {
+        end = '"';
+        s++;
+    }
+    while (*s && *s != end) {
+        if (n + 1 < size)
+            out[n++] = *s;
+        s++;
+    }
+    out[n] = 0;
+    if (end == '"') {
+        if (*s != '"')
+            return false;
+        s++;
+    }
+    *p = s;
+    return true;
+}
+
+static inline bool at_gen_sep(const char** p)
+{
+    if (**p != ',')
+        return false;
+    (*p)++;
+    while (**p == ' ')
+        (*p)++;
+    return true;
+}
+
+// Rest of the line an oob prefix matched, up to its '\n' and never past it:
+// getline would skip an empty rest and take the next line instead
+static inline int at_gen_rest(ATParser *at, char* line, int size)
+{
+    int n = 0;
+    char c;
+
+    while (ATCmdParser_read(at, &c, 1) == 1) {
+        if (c == '\n') {
+            if (n > 0 && line[n - 1] == '\r')
+                n--;
+            line[n] = 0;
+            return n;
+        }
+        if (n + 1 < size)
+            line[n++] = c;
+    }
+    return -1;
+}
+
+static inline bool at_gen_final(const char* line, bool* ok)
+{
+    if (strcmp(line, "OK") == 0) {
+        *ok = true;
+        return true;
+    }
+    if (strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0 || strncmp(line, "+CMS ERROR", 10) == 0) {
+        *ok = false;
+        return true;
+    }
+    return false;
+}
+"""
+
+
+def load(path):
+    with open(path) as f:
+        if path.endswith(('.yaml', '.yml')):
+            try:
+                import yaml
+            except ImportError:
+                sys.exit('atgen: PyYAML is required for YAML descriptions')
+            return yaml.safe_load(f)
+        return json.load(f)
+
+
+def ident(name):
+    out = ''.join(c if c.isalnum() else '_' for c in name)
+    if not out or out[0].isdigit():
+        sys.exit('atgen: invalid identifier "%s"' % name)
+    return out
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def check_type(field):
+    if field.get('type', 'int') not in TYPES:
+        sys.exit('atgen: unknown type "%s" for "%s"' % (field['type'], field['name']))
+
+
+def field_decl(field):
+    ctype = TYPES[field.get('type', 'int')][0]
+    if field.get('type') == 'string':
+        return '    char %s[%d];' % (ident(field['name']), field.get('size', 32))
+    return '    %s %s;' % (ctype, ident(field['name']))
+
+
+def check_fields(fields, what):
+    optional = False
+    for f in fields:
+        check_type(f)
+        if optional and not f.get('optional'):
+            sys.exit('atgen: "%s" of %s follows an optional field' % (f['name'], what))
+        optional = optional or f.get('optional', False)
+
+
+def emit_matcher(fields, out, indent):
+    """Straight-line parse of comma separated fields starting at p."""
+    lines = ['memset(%s, 0, sizeof(*%s));' % (out, out)]
+    for n, field in enumerate(fields):
+        fn = TYPES[field.get('type', 'int')][2]
+        name = ident(field['name'])
+        if field.get('optional'):
+            lines.append('if (*p == 0)')
+            lines.append('    return true;')
+        if n:
+            lines.append('if (!at_gen_sep(&p))')
+            lines.append('    return false;')
+        if field.get('type') == 'string':
+            lines.append('if (!%s(&p, %s->%s, sizeof(%s->%s)))' % (fn, out, name, out, name))
+        else:
+            lines.append('if (!%s(&p, &%s->%s))' % (fn, out, name))
+        lines.append('    return false;')
+    return ''.join(indent + l + '\n' for l in lines)
+
+
+TPL_TYPES = {'d': 'AT_TPL_INT', 'i': 'AT_TPL_INT', 'u': 'AT_TPL_UINT',
+             'x': 'AT_TPL_HEX', 'X': 'AT_TPL_HEX_UPPER', 's': 'AT_TPL_STR', 'c': 'AT_TPL_CHAR'}
+
+
+def split_template(fmt):
+    """Pre-split a send format into at_template parts, None if unsupported."""
+    parts, lit, i = [], '', 0
+    while i < len(fmt):
+        if fmt[i] != '%':
+            lit += fmt[i]
+            i += 1
+            continue
+        spec = fmt[i + 1:i + 2]
+        i += 2
+        if spec == '%':
+            lit += '%'
+            continue
+        if spec not in TPL_TYPES:
+            return None
+        if lit:
+            parts.append('{ AT_TPL_LIT, %d, %s }' % (len(lit), c_string(lit)))
+            lit = ''
+        parts.append('{ %s, 0, NULL }' % TPL_TYPES[spec])
+    if lit:
+        parts.append('{ AT_TPL_LIT, %d, %s }' % (len(lit), c_string(lit)))
+    return parts if len(parts) <= 16 else None
+
+
+def echo_literal(send):
+    """Leading literal of a send format, the start of the command's echo."""
+    lit, i = '', 0
+    while i < len(send):
+        if send[i] == '%':
+            if send[i + 1:i + 2] != '%':
+                break
+            i += 1
+        lit += send[i]
+        i += 1
+    return lit
+
+
+def param_list(cmd):
+    params = []
+    for p in cmd.get('params', []):
+        check_type(p)
+        t = p.get('type', 'int')
+        ctype = 'const char*' if t == 'string' else TYPES[t][0]
+        params.append('%s %s' % (ctype, ident(p['name'])))
+    return params
+
+
+def generate(desc, src):
+    mod = ident(desc['name'])
+    upper = mod.upper()
+    h, c = [], []
+
+    h.append(LICENSE.format(file=mod + '.h', src=src))
+    h.append('#ifndef _%s_AT_H_\n#define _%s_AT_H_\n\n#include "ATCmdParser.h"\n\n' % (upper, upper))
+    h.append('#ifdef __cplusplus\nextern "C" {\n#endif\n\n')
+
+    c.append(LICENSE.format(file=mod + '.c', src=src))
+    c.append('#include "%s.h"\n' % mod)
+    c.append(HELPERS)
+
+    for cmd in desc.get('commands', []):
+        name = ident(cmd['name'])
+        resp = cmd.get('response')
+        params = param_list(cmd)
+        sig = ['ATParser *at'] + params
+        if resp:
+            check_fields(resp.get('fields', []), cmd['name'])
+            h.append('typedef struct {\n%s\n} %s_%s_result;\n\n' % (
+                '\n'.join(field_decl(f) for f in resp['fields']), mod, name))
+            sig.append('%s_%s_result* res' % (mod, name))
+
+            c.append('\nstatic bool %s_%s_match(const char* p, %s_%s_result* res)\n{\n' % (mod, name, mod, name))
+            prefix = resp.get('prefix', '')
+            if prefix:
+                c.append('    if (strncmp(p, %s, %d) != 0)\n        return false;\n' % (c_string(prefix), len(prefix)))
+                c.append('    p += %d;\n' % len(prefix))
+            c.append(emit_matcher(resp['fields'], 'res', '    '))
+            c.append('    return true;\n}\n')
+
+        h.append('/**\n * @brief %s\n */\n' % cmd.get('doc', cmd['send']))
+        h.append('bool %s_%s(%s);\n\n' % (mod, name, ', '.join(sig)))
+
+        tpl = split_template(cmd['send'])
+        if tpl:
+            c.append('\nstatic const at_template %s_%s_tpl = {\n    %d, {\n%s    }\n};\n' % (
+                mod, name, len(tpl), ''.join('        %s,\n' % t for t in tpl)))
+        c.append('\nbool %s_%s(%s)\n{\n' % (mod, name, ', '.join(sig)))
+        c.append('    char line[%d];\n' % cmd.get('line_size', 128))
+        c.append('    int timeout = at->character_timeout;\n')
+        c.append('    bool ok = false, matched = %s;\n\n' % ('false' if resp else 'true'))
+        args = ''.join(', ' + ident(p['name']) for p in cmd.get('params', []))
+        if tpl:
+            c.append('    if (!ATCmdParser_send_template(at, &%s_%s_tpl%s))\n        return false;\n' % (mod, name, args))
+        else:
+            c.append('    if (!ATCmdParser_send(at, %s%s))\n        return false;\n' % (c_string(cmd['send']), args))
+        if 'timeout' in cmd:
+            c.append('    at->character_timeout = %d;\n' % cmd['timeout'])
+        c.append('    while (ATCmdParser_getline(at, line, sizeof(line)) >= 0) {\n')
+        c.append('        if (at_gen_final(line, &ok))\n            break;\n')
+        if resp and not resp.get('prefix'):
+            echo = echo_literal(cmd['send'])
+            c.append('        if (strncmp(line, %s, %d) == 0)\n            continue;\n' % (c_string(echo), len(echo)))
+        if resp:
+            c.append('        if (!matched)\n            matched = %s_%s_match(line, res);\n' % (mod, name))
+        c.append('    }\n')
+        c.append('    at->character_timeout = timeout;\n')
+        c.append('    return ok && matched;\n}\n')
+
+    urcs = desc.get('urcs', [])
+    if urcs:
+        for urc in urcs:
+            check_fields(urc.get('fields', []), urc['name'])
+            name = ident(urc['name'])
+            h.append('typedef struct {\n%s\n} %s_%s_urc;\n\n' % (
+                '\n'.join(field_decl(f) for f in urc['fields']) or '    char unused;', mod, name))
+        h.append('typedef struct {\n')
+        for urc in urcs:
+            name = ident(urc['name'])
+            h.append('    void (*%s)(ATParser *at, const %s_%s_urc* urc);\n' % (name, mod, name))
+        h.append('} %s_urc_handlers;\n\n' % mod)
+        h.append('typedef struct {\n    struct oob oobs[%d];\n} %s_urc_nodes;\n\n' % (len(urcs), mod))
+        h.append('/**\n * @brief Register the URC dispatch table on one parser, handlers may be NULL;\n'
+                 ' *        nodes and handlers must stay valid while the parser is used\n */\n')
+        h.append('void %s_register_urcs_static(ATParser *at, %s_urc_nodes* nodes, const %s_urc_handlers* handlers);\n\n' % (mod, mod, mod))
+        h.append('#ifndef ATCMDPARSER_NO_MALLOC\n')
+        h.append('bool %s_register_urcs(ATParser *at, const %s_urc_handlers* handlers);\n' % (mod, mod))
+        h.append('#endif\n\n')
+        for urc in urcs:
+            name = ident(urc['name'])
+            if urc.get('fields'):
+                c.append('\nstatic bool %s_%s_match(const char* p, %s_%s_urc* urc)\n{\n' % (mod, name, mod, name))
+                c.append('    while (*p == \' \')\n        p++;\n')
+                c.append(emit_matcher(urc['fields'], 'urc', '    '))
+                c.append('    return true;\n}\n')
+            c.append('\nstatic void %s_%s_oob(void* arg)\n{\n' % (mod, name))
+            # Taken before reading, a nested dispatch has its own argument
+            c.append('    ATParser *at = arg;\n    const %s_urc_handlers* handlers = ATCmdParser_oob_arg(at);\n' % mod)
+            if urc.get('fields'):
+                c.append('    char line[%d];\n    %s_%s_urc urc;\n\n' % (urc.get('line_size', 128), mod, name))
+                c.append('    if (at_gen_rest(at, line, sizeof(line)) < 0 || !%s_%s_match(line, &urc))\n        return;\n' % (mod, name))
+            else:
+                # Bare URCs like "RDY" have nothing left to read
+                c.append('    %s_%s_urc urc = { 0 };\n\n' % (mod, name))
+            c.append('    if (handlers && handlers->%s)\n        handlers->%s(at, &urc);\n}\n' % (name, name))
+
+        c.append('\nstatic const struct {\n    const char* prefix;\n    oob_callback cb;\n} %s_urc_table[] = {\n' % mod)
+        for urc in urcs:
+            c.append('    { %s, %s_%s_oob },\n' % (c_string(urc['prefix']), mod, ident(urc['name'])))
+        c.append('};\n')
+        c.append('\nvoid %s_register_urcs_static(ATParser *at, %s_urc_nodes* nodes, const %s_urc_handlers* handlers)\n{\n' % (mod, mod, mod))
+        c.append('    for (size_t i = 0; i < sizeof(%s_urc_table) / sizeof(%s_urc_table[0]); i++)\n' % (mod, mod))
+        c.append('        ATCmdParser_add_oob_arg(at, &nodes->oobs[i], %s_urc_table[i].prefix, %s_urc_table[i].cb, (void*)handlers);\n}\n' % (mod, mod))
+        c.append('\n#ifndef ATCMDPARSER_NO_MALLOC\n')
+        c.append('bool %s_register_urcs(ATParser *at, const %s_urc_handlers* handlers)\n{\n' % (mod, mod))
+        c.append('    %s_urc_nodes* nodes = malloc(sizeof(%s_urc_nodes));\n\n' % (mod, mod))
+        c.append('    if (!nodes)\n        return false;\n')
+        c.append('    %s_register_urcs_static(at, nodes, handlers);\n    return true;\n}\n#endif\n' % mod)
+
+    h.append('#ifdef __cplusplus\n} /* extern "C" */\n#endif\n\n#endif //_%s_AT_H_\n' % upper)
+    return ''.join(h), ''.join(c)
+
+
+def generate_cpp(desc, src):
+    mod = ident(desc['name'])
+    cls = ''.join(w.capitalize() for w in mod.split('_'))
+    upper = mod.upper()
+    out = [LICENSE.format(file=mod + '.hpp', src=src)]
+    out.append('#ifndef _%s_AT_HPP_\n#define _%s_AT_HPP_\n\n#include "%s.h"\n\n' % (upper, upper, mod))
+    out.append('class %s {\npublic:\n    explicit %s(ATParser *at) : _at(at) {}\n\n' % (cls, cls))
+    for cmd in desc.get('commands', []):
+        name = ident(cmd['name'])
+        params = param_list(cmd)
+        args = [ident(p['name']) for p in cmd.get('params', [])]
+        if cmd.get('response'):
+            params.append('%s_%s_result& res' % (mod, name))
+            args.append('&res')
+        out.append('    bool %s(%s) { return %s_%s(%s); }\n' % (
+            name, ', '.join(params), mod, name, ', '.join(['_at'] + args)))
+    if desc.get('urcs'):
+        out.append('\n    void register_urcs(%s_urc_nodes& nodes, const %s_urc_handlers& handlers) { %s_register_urcs_static(_at, &nodes, &handlers); }\n' % (mod, mod, mod))
+    out.append('\nprivate:\n    ATParser *_at;\n};\n\n#endif //_%s_AT_HPP_\n' % upper)
+    return ''.join(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Generate ATCmdParser bindings from a command-set description')
+    ap.add_argument('description')
+    ap.add_argument('-o', '--outdir', default='.')
+    ap.add_argument('--cpp', action='store_true', help='also emit a C++ wrapper class')
+    args = ap.parse_args()
+
+    desc = load(args.description)
+    src = os.path.basename(args.description)
+    mod = ident(desc['name'])
+    header, source = generate(desc, src)
+    files = {mod + '.h': header, mod + '.c': source}
+    if args.cpp:
+        files[mod + '.hpp'] = generate_cpp(desc, src)
+    for name, text in files.items():
+        with open(os.path.join(args.outdir, name), 'w') as f:
+            f.write(text)
+
+
+if __name__ == '__main__':
+    main()